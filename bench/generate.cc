@@ -0,0 +1,118 @@
+// Generates random instances in the kiwi input format for benchmarking.
+//
+// The number of days defaults to the number of airports, so that every
+// airport has to be visited. With fewer days only some of them are. Each
+// possible flight (src, dest, day) exists with the given density. Unless
+// --no-plant is given, a random cycle through as many airports as there are
+// days is added as well, which makes the instance feasible.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+struct options_t {
+    options_t() : airports(50), days(0), density(0.1), min_price(50), max_price(2000),
+        skewed(false), plant(true), seed(1) {};
+
+    int airports;
+    int days;       // 0 for as many as airports
+    double density;
+    int min_price, max_price;
+    bool skewed;    // Most flights cheap, a few expensive, instead of uniform prices
+    bool plant;     // Add a random cycle so the instance is feasible
+    unsigned int seed;
+};
+
+std::string airport_code(int idx) {
+    std::string code(3, 'A');
+    for (int k = 2; k >= 0; --k) {
+        code[k] = 'A' + idx % 26;
+        idx /= 26;
+    }
+    return code;
+}
+
+int usage(const char *name) {
+    std::cerr << "Usage: " << name << " [--airports N] [--days N] [--density P] [--min-price N] [--max-price N]"
+              << " [--prices uniform|skewed] [--no-plant] [--seed N]" << std::endl;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    options_t options;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--airports") == 0 && i + 1 < argc) {
+            options.airports = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+            options.days = atoi(argv[++i]);
+            if (options.days < 1) return usage(argv[0]);
+        } else if (strcmp(argv[i], "--density") == 0 && i + 1 < argc) {
+            options.density = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--min-price") == 0 && i + 1 < argc) {
+            options.min_price = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-price") == 0 && i + 1 < argc) {
+            options.max_price = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--prices") == 0 && i + 1 < argc) {
+            options.skewed = strcmp(argv[++i], "skewed") == 0;
+        } else if (strcmp(argv[i], "--no-plant") == 0) {
+            options.plant = false;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = atoi(argv[++i]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (options.days == 0) options.days = options.airports;
+
+    // An airport can't be visited twice, so there can't be more days
+    if (options.airports < 2 || options.airports > 26 * 26 * 26 || options.days > options.airports ||
+        options.min_price > options.max_price) {
+        return usage(argv[0]);
+    }
+
+    std::mt19937 random(options.seed);
+    std::uniform_int_distribution<int> uniform_price(options.min_price, options.max_price);
+    std::exponential_distribution<double> skewed_price(4.0 / (options.max_price - options.min_price + 1));
+    std::bernoulli_distribution exists(options.density);
+
+    auto price = [&]() {
+        if (!options.skewed) return uniform_price(random);
+        return std::min(options.max_price, options.min_price + (int) skewed_price(random));
+    };
+
+    int n = options.airports;
+    int days = options.days;
+    std::vector<int> cycle(n);
+    for (int k = 0; k < n; ++k) cycle[k] = k;
+    std::shuffle(cycle.begin(), cycle.end(), random);
+
+    std::vector<std::string> codes(n);
+    for (int k = 0; k < n; ++k) codes[k] = airport_code(k);
+
+    // Output through stdio, iostreams are too slow for the big instances
+    std::printf("%s\n", codes[cycle[0]].c_str());
+
+    // The planted cycle goes through the first airports of the shuffled order
+    for (int day = 0; day < days; ++day) {
+        int planted_src = cycle[day];
+        int planted_dest = cycle[(day + 1) % days];
+
+        for (int src = 0; src < n; ++src) {
+            for (int dest = 0; dest < n; ++dest) {
+                if (src == dest) continue;
+                bool planted = options.plant && src == planted_src && dest == planted_dest;
+                if (!planted && !exists(random)) continue;
+                std::printf("%s %s %d %d\n", codes[src].c_str(), codes[dest].c_str(), day, price());
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Compares the input parsers: reads generated instances with every parser
+# and prints one JSON object per run with the phase report written by
+# kiwi --report, read_ms is the one to look at. The search gets the
+# shortest budget possible, it's not what is measured here.
+#
+# Usage: bench/parse.sh [output file]
+#
+# KIWI, GENERATE, PARSERS, INGEST, REPEAT and INSTANCES override the
+# defaults below. INSTANCES is a list of "airports:density:prices" triples.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+KIWI=${KIWI:-./kiwi}
+GENERATE=${GENERATE:-bench/generate}
+PARSERS=${PARSERS:-"csv fast"}
+INGEST=${INGEST:-sequential}
+REPEAT=${REPEAT:-3}
+INSTANCES=${INSTANCES:-"100:0.5:uniform 200:0.5:uniform 300:0.5:skewed"}
+OUTPUT=${1:-/dev/stdout}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+: > "$WORK/results"
+
+for instance in $INSTANCES; do
+    airports=${instance%%:*}
+    rest=${instance#*:}
+    density=${rest%%:*}
+    prices=${rest#*:}
+
+    "$GENERATE" --airports "$airports" --density "$density" --prices "$prices" --seed "$airports" > "$WORK/instance.txt"
+    bytes=$(wc -c < "$WORK/instance.txt")
+
+    for parser in $PARSERS; do
+        run=0
+        while [ "$run" -lt "$REPEAT" ]; do
+            run=$((run + 1))
+            rm -f "$WORK/report.json"
+            status=0
+            "$KIWI" --input "$WORK/instance.txt" --parser "$parser" --ingest "$INGEST" --time-limit 1 \
+                --exact-max-days 0 --report "$WORK/report.json" > /dev/null 2>&1 || status=$?
+            [ -s "$WORK/report.json" ] || echo '{}' > "$WORK/report.json"
+
+            printf '{"airports": %s, "density": %s, "prices": "%s", "bytes": %s, "parser": "%s", "ingest": "%s", "run": %s, "status": %s, "report": %s}\n' \
+                "$airports" "$density" "$prices" "$bytes" "$parser" "$INGEST" "$run" "$status" "$(cat "$WORK/report.json")" >> "$WORK/results"
+        done
+    done
+done
+
+cat "$WORK/results" > "$OUTPUT"
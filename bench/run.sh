@@ -0,0 +1,49 @@
+#!/bin/sh
+# Runs kiwi on generated instances and prints one JSON object per run:
+# the instance parameters, the time budget and the phase report written by
+# kiwi --report. Compare the output of two releases to spot regressions.
+#
+# Usage: bench/run.sh [output file]
+#
+# KIWI, GENERATE, BUDGETS, THREADS and INSTANCES override the defaults below.
+# INSTANCES is a list of "airports:density:prices" triples. Swaps need four
+# flights to exist, so only the dense ones show how well the search does,
+# the sparse ones are there for the construction and the reading.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+KIWI=${KIWI:-./kiwi}
+GENERATE=${GENERATE:-bench/generate}
+BUDGETS=${BUDGETS:-"1000 5000"}
+THREADS=${THREADS:-1}
+INSTANCES=${INSTANCES:-"10:0.5:uniform 20:0.3:uniform 50:0.2:uniform 100:0.1:skewed 200:0.05:uniform 300:0.05:skewed 40:0.8:uniform 80:0.9:skewed 150:0.7:uniform"}
+OUTPUT=${1:-/dev/stdout}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+: > "$WORK/results"
+
+for instance in $INSTANCES; do
+    airports=${instance%%:*}
+    rest=${instance#*:}
+    density=${rest%%:*}
+    prices=${rest#*:}
+
+    "$GENERATE" --airports "$airports" --density "$density" --prices "$prices" --seed "$airports" > "$WORK/instance.txt"
+
+    for budget in $BUDGETS; do
+        rm -f "$WORK/report.json"
+        status=0
+        "$KIWI" --input "$WORK/instance.txt" --time-limit "$budget" --threads "$THREADS" \
+            --report "$WORK/report.json" > /dev/null 2>&1 || status=$?
+        [ -s "$WORK/report.json" ] || echo '{}' > "$WORK/report.json"
+
+        printf '{"airports": %s, "density": %s, "prices": "%s", "budget_ms": %s, "threads": %s, "status": %s, "report": %s}\n' \
+            "$airports" "$density" "$prices" "$budget" "$THREADS" "$status" "$(cat "$WORK/report.json")" >> "$WORK/results"
+    done
+done
+
+cat "$WORK/results" > "$OUTPUT"
@@ -136,6 +136,14 @@ namespace io{
         class ByteSourceBase{
         public:
                 virtual int read(char*buffer, int size)=0;
+
+                // Sources that have the whole input in memory return it here,
+                // the LineReader then scans it directly instead of calling read.
+                virtual const char*map(long long&size){
+                        size = 0;
+                        return 0;
+                }
+
                 virtual ~ByteSourceBase(){}
         };
 
@@ -196,6 +204,33 @@ namespace io{
                         long long remaining_byte_count;
                 };
 
+                // Input already in memory, like a mapped file, owned by the caller
+                class MemoryMappedByteSource : public ByteSourceBase{
+                public:
+                        MemoryMappedByteSource(const char*data, long long size):data(data), size(size), position(0){}
+
+                        int read(char*buffer, int desired_byte_count){
+                                int to_copy_byte_count = desired_byte_count;
+                                if(size - position < to_copy_byte_count)
+                                        to_copy_byte_count = size - position;
+                                std::memcpy(buffer, data + position, to_copy_byte_count);
+                                position += to_copy_byte_count;
+                                return to_copy_byte_count;
+                        }
+
+                        const char*map(long long&mapped_size){
+                                mapped_size = size;
+                                return data;
+                        }
+
+                        ~MemoryMappedByteSource(){}
+
+                private:
+                        const char*data;
+                        long long size;
+                        long long position;
+                };
+
                 #ifndef CSV_IO_NO_THREAD
                 class AsynchronousReader{
                 public:
@@ -323,6 +358,15 @@ namespace io{
                 int data_begin;
                 int data_end;
 
+                // Set when the byte source has all input in memory. Lines are
+                // found in the mapping and only copied one at a time into
+                // line_buffer to terminate them.
+                std::unique_ptr<ByteSourceBase>mapped_source;
+                const char*mapped_data;
+                long long mapped_begin;
+                long long mapped_end;
+                std::vector<char>line_buffer;
+
                 char file_name[error::max_file_name_length+1];
                 unsigned file_line;
 
@@ -343,6 +387,19 @@ namespace io{
                 void init(std::unique_ptr<ByteSourceBase>byte_source){
                         file_line = 0;
 
+                        mapped_data = byte_source->map(mapped_end);
+                        if(mapped_data != 0){
+                                mapped_begin = 0;
+                                data_begin = data_end = 0;
+
+                                // Ignore UTF-8 BOM
+                                if(mapped_end >= 3 && mapped_data[0] == '\xEF' && mapped_data[1] == '\xBB' && mapped_data[2] == '\xBF')
+                                        mapped_begin = 3;
+
+                                mapped_source = std::move(byte_source);
+                                return;
+                        }
+
                         buffer = std::unique_ptr<char[]>(new char[3*block_len]);
                         data_begin = 0;
                         data_end = byte_source->read(buffer.get(), 2*block_len);
@@ -382,14 +439,15 @@ namespace io{
                         init(std::move(byte_source));
                 }
 
+                // The lines are found in place, data has to outlive the reader
                 LineReader(const char*file_name, const char*data_begin, const char*data_end){
                         set_file_name(file_name);
-                        init(std::unique_ptr<ByteSourceBase>(new detail::NonOwningStringByteSource(data_begin, data_end-data_begin)));
+                        init(std::unique_ptr<ByteSourceBase>(new detail::MemoryMappedByteSource(data_begin, data_end-data_begin)));
                 }
 
                 LineReader(const std::string&file_name, const char*data_begin, const char*data_end){
                         set_file_name(file_name.c_str());
-                        init(std::unique_ptr<ByteSourceBase>(new detail::NonOwningStringByteSource(data_begin, data_end-data_begin)));
+                        init(std::unique_ptr<ByteSourceBase>(new detail::MemoryMappedByteSource(data_begin, data_end-data_begin)));
                 }
 
                 LineReader(const char*file_name, FILE*file){
@@ -433,7 +491,38 @@ namespace io{
                         return file_line;
                 }
 
+                char*next_mapped_line(){
+                        if(mapped_begin == mapped_end)
+                                return 0;
+
+                        ++file_line;
+
+                        const char*line = mapped_data + mapped_begin;
+                        const char*line_end = static_cast<const char*>(std::memchr(line, '\n', mapped_end - mapped_begin));
+                        if(line_end == 0){
+                                // some files are missing the newline at the end of the
+                                // last line
+                                line_end = mapped_data + mapped_end;
+                                mapped_begin = mapped_end;
+                        }else{
+                                mapped_begin = line_end - mapped_data + 1;
+                        }
+
+                        // handle windows \r\n-line breaks
+                        if(line_end != line && line_end[-1] == '\r')
+                                --line_end;
+
+                        if(line_buffer.size() < (size_t)(line_end - line) + 1)
+                                line_buffer.resize(line_end - line + 1);
+                        std::memcpy(line_buffer.data(), line, line_end - line);
+                        line_buffer[line_end - line] = '\0';
+                        return line_buffer.data();
+                }
+
                 char*next_line(){
+                        if(mapped_data != 0)
+                                return next_mapped_line();
+
                         if(data_begin == data_end)
                                 return 0;
 
@@ -1,14 +1,44 @@
 // vim: let g:syntastic_cpp_compiler_options=' -std=c++0x '
 
 #include <iostream>
+#include <fstream>
 #include <map>
+#include <deque>
 #include <unordered_map>
 #include <vector>
 #include <string>
-#include <set>
-#include <stack>
-#include <ctime>
+#include <chrono>
 #include <array>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cmath>
+// The SIMD code is x86 only, elsewhere the scalar code does it all
+#if defined(__x86_64__) || defined(__i386__)
+#define KIWI_X86 1
+#include <immintrin.h>
+#endif
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
 
 #include "csv.h"
 
@@ -21,135 +51,281 @@ struct nodename_hash_t {
     size_t operator () (const nodename_t &nodename) const;
 };
 
-struct route_t;
+struct node_t;
 
-struct route_ptr_compare_t {
-    bool operator () (const route_t* const &lhs, const route_t* const &rhs) const;
+// Price of a path or of a move. Up to 65535 days at up to 65535 each don't
+// fit an int.
+typedef int64_t price_t;
+
+struct route_t {
+    route_t(node_t *src, node_t *dest, uint16_t price):
+        src(src), dest(dest), price(price)
+    {};
+
+    node_t *src, *dest;
+    uint16_t price;
 };
 
 struct node_t {
-    node_t(nodename_t name, uint16_t idx) : name(name), idx(idx) {
+    node_t(nodename_t name, uint16_t idx) : idx(idx), name(name),
+        day_offsets(NULL), route_dests(NULL), routes(NULL), cheapest_routes(NULL) {
 
     };
 
-    void add_route(uint16_t day, uint16_t dest_idx, route_t * route) {
-    /*
-        if (routes.size() <= day) {
-            routes.resize(day + 1);
-        }
+    route_t * get_route(uint16_t day, uint16_t dest_idx) {
+        const uint16_t *first = route_dests + day_offsets[day];
+        const uint16_t *last = route_dests + day_offsets[day + 1];
+        const uint16_t *it = std::lower_bound(first, last, dest_idx);
+        if (it == last || *it != dest_idx) return NULL;
+        return routes + (it - route_dests);
+    }
 
-        if (routes[day].size() <= dest_idx) {
-            routes[day].resize(dest_idx + 1, NULL);
-        }
-*/
-        routes[300*day + dest_idx] = route;
+    // Routes departing on given day, ordered by destination index
+    route_t * routes_begin(uint16_t day) {
+        return routes + day_offsets[day];
     }
 
-    route_t * get_route(uint16_t day, uint16_t dest_idx) {
-        return routes[300*day + dest_idx];
+    route_t * routes_end(uint16_t day) {
+        return routes + day_offsets[day + 1];
+    }
+
+    // The same routes ordered by price
+    route_t * const * cheapest_routes_begin(uint16_t day) {
+        return cheapest_routes + day_offsets[day];
+    }
+
+    route_t * const * cheapest_routes_end(uint16_t day) {
+        return cheapest_routes + day_offsets[day + 1];
     }
 
     uint16_t idx;
     nodename_t name;
-    //std::vector< std::vector<route_t*> > routes;
-    route_t *routes[90000] = {0};
+
+    // Routes of day d are routes[day_offsets[d]] .. routes[day_offsets[d+1] - 1],
+    // route_dests[k] == routes[k].dest->idx is kept separately for lookups.
+    // The arrays are shared by all nodes (see build_graph()), only
+    // day_offsets points to this node's part of them.
+    const uint32_t *day_offsets;
+    const uint16_t *route_dests;
+    route_t *routes;
+    route_t * const *cheapest_routes;
 };
 
-struct route_t {
-    route_t(node_t *src, node_t *dest, uint16_t price):
-        src(src), dest(dest), price(price),
-        path_prev(NULL)
-    {};
+// Bump allocator owning the flight graph. Nothing is freed one by one, the
+// blocks are all released at once when the arena goes away or handed out
+// again after reset(), so it only holds trivially destructible objects.
+struct arena_t {
+    static const size_t BLOCK_SIZE = 1 << 20;
 
-    node_t *src, *dest;
-    uint16_t price;
+    struct block_t {
+        char *data;
+        size_t size;
+    };
 
-    route_t *path_prev;
-};
+    arena_t() : used(0), next(NULL), left(0) {};
+    arena_t(const arena_t &) = delete;
+    arena_t &operator = (const arena_t &) = delete;
 
-enum op_t {
-    FORTH, BACK
-};
+    ~arena_t() {
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            free(it->data);
+        }
+    }
 
-struct stack_op_t {
-    stack_op_t(op_t op, route_t * route) : op(op), route(route) {};
-    op_t op;
-    route_t *route;
-};
+    // Forgets all objects, their blocks are kept for the next ones
+    void reset() {
+        used = 0;
+        next = NULL;
+        left = 0;
+    }
 
-struct semimatrix_t {
-    semimatrix_t(uint16_t node_count, int threshold) : node_count(node_count), current_max(threshold), threshold(threshold) {
-        storage = new int*[node_count];
-        for (uint16_t i = 2; i < node_count; ++i) {
-            storage[i] = new int[i - 1];
-            for (uint16_t j = 0; j < i -1; j++) {
-                storage[i][j] = 0;
+    void * allocate(size_t bytes, size_t align) {
+        size_t padding = (align - (uintptr_t) next % align) % align;
+        while (padding + bytes > left) {
+            // Kept blocks are taken in order, too small ones are skipped.
+            // Anything bigger than a block gets a block of its own.
+            if (used == blocks.size()) {
+                block_t block = { NULL, std::max(bytes + align, BLOCK_SIZE) };
+                block.data = (char *) malloc(block.size);
+                if (block.data == NULL) throw std::bad_alloc();
+                blocks.push_back(block);
             }
+            next = blocks[used].data;
+            left = blocks[used].size;
+            used++;
+            padding = (align - (uintptr_t) next % align) % align;
         }
+
+        void *result = next + padding;
+        next += padding + bytes;
+        left -= padding + bytes;
+        return result;
     }
-    ~semimatrix_t() {
-        for (uint16_t i = 2; i < node_count; ++i) {
-            delete [] storage[i];
-        }
-        delete [] storage;
+
+    template <typename T, typename... Args>
+    T * make(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
     }
 
-    void set(uint16_t node1, uint16_t node2) {
-        current_max++; // TODO handle overflow
-        storage[node1][node2] = current_max;
+    // Uninitialized storage for count objects
+    template <typename T>
+    T * make_array(size_t count) {
+        return static_cast<T *>(allocate(sizeof(T) * std::max<size_t>(count, 1), alignof(T)));
     }
 
-    bool applies(uint16_t node1, uint16_t node2) {
-        return storage[node1][node2] > current_max - threshold;
+    std::vector<block_t> blocks;
+    size_t used;  // Blocks handed out since the last reset()
+    char *next;
+    size_t left;
+};
+
+// One line of the input, kept until the graph is built
+struct flight_t {
+    uint16_t src_idx, dest_idx, day, price;
+};
+
+// Set of node indices, one bit per node
+struct node_set_t {
+    node_set_t(size_t node_count) : words((node_count + 63) / 64, 0) {};
+
+    bool contains(uint16_t idx) const {
+        return (words[idx >> 6] >> (idx & 63)) & 1;
     }
 
-    void inc(uint16_t node1, uint16_t node2) {
-        storage[node1][node2]++;
+    void insert(uint16_t idx) {
+        words[idx >> 6] |= (uint64_t) 1 << (idx & 63);
     }
 
-    int get(uint16_t node1, uint16_t node2) {
-        return storage[node1][node2];
+    void erase(uint16_t idx) {
+        words[idx >> 6] &= ~((uint64_t) 1 << (idx & 63));
     }
 
-    void get_minimum(uint16_t * node1, uint16_t * node2) {
-        *node1 = 2;
-        *node2 = 1;
-        int min = -1;
+    std::vector<uint64_t> words;
+};
+
+// Routes of one DFS level still to be tried
+struct dfs_frame_t {
+    route_t * const *next;
+    route_t * const *end;
+};
+
+// Whether the AVX2 code paths can be taken
+bool cpu_has_avx2() {
+#ifdef KIWI_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+// Dense price[day][src][dest] table for the move evaluation, missing routes
+// hold MISSING. Takes days * nodes^2 ints, so it's only built when that fits
+// under the configured limit.
+struct price_table_t {
+    static const int32_t MISSING = 1 << 24;  // Sum of four still fits in int32_t
+
+    price_table_t() : node_count(0), days_total(0), use_avx2(cpu_has_avx2()) {};
 
-        for (uint16_t i = 2; i < node_count; ++i) {
-            for (uint16_t j = 1; j < i - 1; ++j) {
-                if (min == -1 || storage[i][j] < min) {
-                    min = storage[i][j];
-                    *node1 = i;
-                    *node2 = j;
+    // Fills the table for another graph, reusing the storage if it's big enough
+    void build(const std::vector<node_t*> &nodes, uint16_t days_total) {
+        node_count = nodes.size();
+        this->days_total = days_total;
+        prices.assign(required_bytes(nodes.size(), days_total) / sizeof(int32_t), MISSING);
+
+        for (auto it = nodes.cbegin(); it != nodes.cend(); ++it) {
+            for (uint16_t day = 0; day < days_total; ++day) {
+                for (route_t *route = (*it)->routes_begin(day); route != (*it)->routes_end(day); ++route) {
+                    prices[offset(day, route->src->idx, route->dest->idx)] = route->price;
                 }
             }
         }
+    }
 
+    static size_t required_bytes(size_t node_count, uint16_t days_total) {
+        return sizeof(int32_t) * days_total * node_count * node_count;
     }
 
-    void clear() {
-        for (uint16_t i = 2; i < node_count; ++i) {
-            for (uint16_t j = 0; j < i - 1; ++j) {
-                storage[i][j] = 0;
-            }
+    // Offsets are int32_t to suit the vector gathers
+    static bool fits(size_t node_count, uint16_t days_total, size_t limit) {
+        size_t bytes = required_bytes(node_count, days_total);
+        return bytes <= limit && bytes / sizeof(int32_t) <= INT32_MAX;
+    }
+
+    int32_t offset(uint16_t day, uint16_t src_idx, uint16_t dest_idx) const {
+        return ((int32_t) day * node_count + src_idx) * node_count + dest_idx;
+    }
+
+    int32_t node_count;
+    uint16_t days_total;
+    std::vector<int32_t> prices;
+    bool use_avx2;
+};
+
+// Triangular matrix over pairs (i, j) with i > j, zeroed, in one cache
+// line aligned block. Row i starts at i * (i - 1) / 2, so the j loop
+// for a fixed i walks memory in order.
+template <typename T>
+struct semimatrix_t {
+    static const size_t ALIGNMENT = 64;
+
+    semimatrix_t(uint16_t size) : size(size), storage(NULL) {
+        void *block;
+        if (posix_memalign(&block, ALIGNMENT, std::max<size_t>(index(size, 0), 1) * sizeof(T)) != 0) {
+            throw std::bad_alloc();
         }
+        storage = static_cast<T *>(block);
+        std::fill(storage, storage + index(size, 0), T());
+    }
+
+    ~semimatrix_t() {
+        free(storage);
+    }
+
+    semimatrix_t(const semimatrix_t &) = delete;
+    semimatrix_t & operator = (const semimatrix_t &) = delete;
+
+    static size_t index(uint16_t i, uint16_t j) {
+        return (size_t) i * (i - 1) / 2 + j;
+    }
+
+    T & operator () (uint16_t i, uint16_t j) {
+        return storage[index(i, j)];
+    }
+
+    const T & operator () (uint16_t i, uint16_t j) const {
+        return storage[index(i, j)];
     }
 
-    int **storage;
-    uint16_t node_count;
-    int current_max;
-    int threshold;
-}; 
+    uint16_t size;
+    T *storage;
+};
+
+// SWAP exchanges the cities at i > j. RELOCATE moves the `length` cities
+// starting at i so that they start at j. REVERSE reverses the cities j .. i.
+enum move_type_t { SWAP, RELOCATE, REVERSE, MOVE_TYPES };
+const unsigned int ALL_MOVES = (1 << MOVE_TYPES) - 1;
+const uint16_t MAX_RELOCATE_LENGTH = 3;
 
 struct neighbour_t {
     uint16_t i,j;
-    int price;
+    price_t price;
+    move_type_t type;
+    uint16_t length;
+
+    neighbour_t() : i(0), j(0), price(0), type(SWAP), length(0) {};
+    neighbour_t(uint16_t i, uint16_t j, price_t price, move_type_t type = SWAP, uint16_t length = 0)
+        : i(i), j(j), price(price), type(type), length(length) {};
 
-    neighbour_t() : i(0), j(0), price(0) {};
-    neighbour_t(uint16_t i, uint16_t j, int price) : i(i), j(j), price(price) {};
+    // Tabu attributes of the move, key_i() > key_j()
+    uint16_t key_i() const { return std::max(i, j); }
+    uint16_t key_j() const { return std::min(i, j); }
 
     void apply(std::vector<route_t*> &path) {
+        if (type != SWAP) {
+            apply_segment(path);
+            return;
+        }
+
         node_t * node_i_pre = path[i-1]->src;
         node_t * node_i = path[i]->src;
         node_t * node_i_post = path[i]->dest;
@@ -170,6 +346,34 @@ struct neighbour_t {
         }
     };
 
+    // Rearranges the cities first .. last and re-routes every day around them
+    void apply_segment(std::vector<route_t*> &path) {
+        uint16_t first = key_j();
+        uint16_t last = type == RELOCATE ? key_i() + length - 1 : i;
+
+        static thread_local std::vector<node_t*> city;
+        city.resize(last - first + 1);
+        for (uint16_t k = first; k <= last; ++k) {
+            city[k - first] = path[k]->src;
+        }
+        node_t * before = path[first - 1]->src;
+        node_t * after = path[last]->dest;
+
+        if (type == REVERSE) {
+            std::reverse(city.begin(), city.end());
+        } else if (j > i) {
+            std::rotate(city.begin(), city.begin() + length, city.end());
+        } else {
+            std::rotate(city.begin(), city.begin() + (i - j), city.end());
+        }
+
+        for (uint16_t day = first - 1; day <= last; ++day) {
+            node_t * src = day < first ? before : city[day - first];
+            node_t * dest = day == last ? after : city[day + 1 - first];
+            path[day] = src->get_route(day, dest->idx);
+        }
+    }
+
     bool try_apply(std::vector<route_t*> &path) {
         node_t * node_i_pre = path[i-1]->src;
         node_t * node_i = path[i]->src;
@@ -185,7 +389,6 @@ struct neighbour_t {
 
         if (new_i_right == NULL || new_j_left == NULL) return false;
 
-        route_t * new_i_left;
         route_t * new_j_right;
 
         if (i - j > 1) {
@@ -209,393 +412,4068 @@ struct neighbour_t {
     };
 };
 
-std::unordered_map<nodename_t, int, nodename_hash_t> node_name_map;
-time_t started = time(NULL);
+// Swaps (i, j) ordered by how often they were used, least used first. The
+// pairs of one count sit next to each other, so an increment only swaps a
+// pair with the last one of its bucket and moves the bucket boundary, O(1).
+struct frequency_order_t {
+    frequency_order_t(uint16_t days_total) {
+        for (uint16_t i = 2; i + 1 < days_total; ++i) {
+            for (uint16_t j = 1; j < i; ++j) {
+                position.push_back(pair_i.size());
+                order.push_back(pair_i.size());
+                pair_i.push_back(i);
+                pair_j.push_back(j);
+            }
+        }
+        count.assign(order.size(), 0);
+        first.push_back(0);
+        first.push_back(order.size());
+    }
 
-struct penalized_neighbour_compare_t {
-    bool operator () (const std::pair<int,neighbour_t> &lhs, const std::pair<int,neighbour_t> &rhs) const;
-};
+    static uint32_t id(uint16_t i, uint16_t j) {
+        return (uint32_t) (i - 1) * (i - 2) / 2 + j - 1;
+    }
 
+    void inc(uint16_t i, uint16_t j) {
+        uint32_t pair = id(i, j);
+        uint32_t c = count[pair]++;
+        if (first.size() == c + 2) first.push_back(order.size());
+
+        // Last of bucket c changes places with the pair, which then starts bucket c + 1
+        uint32_t last = --first[c + 1];
+        uint32_t other = order[last];
+        std::swap(order[position[pair]], order[last]);
+        position[other] = position[pair];
+        position[pair] = last;
+    }
 
-uint16_t read_input(std::vector<node_t*> &nodes, node_t* &start, uint16_t &minimal_price) {
-    io::CSVReader<4, io::trim_chars<>, io::no_quote_escape<' '>, io::ignore_overflow > reader("stdin", std::cin);
+    std::vector<uint32_t> order;     // Pairs, least used first
+    std::vector<uint32_t> position;  // Of every pair in order
+    std::vector<uint32_t> count;
+    std::vector<uint32_t> first;     // Position of the first pair used at least c times
+    std::vector<uint16_t> pair_i, pair_j;
+};
 
-    char *start_code_raw = reader.next_line();
-    nodename_t start_code = {start_code_raw[0], start_code_raw[1], start_code_raw[2], 0};
+// Tabu status and use frequency of the moves. Every move type has its own
+// (key_i, key_j) attributes. Tabu status is the iteration a move was last
+// made: it's tabu while stamp > iteration - tenure, and clearing just
+// moves the epoch, stamps from before it don't count.
+struct tabu_memory_t {
+    tabu_memory_t(uint16_t days_total)
+        : tenure(days_total - 1), iteration(0), epoch(0), history(days_total), swap_order(days_total) {
+        for (int type = 0; type < MOVE_TYPES; ++type) {
+            tabu[type].reset(new semimatrix_t<uint64_t>(days_total));
+            freq[type].reset(new semimatrix_t<int>(days_total));
+        }
+    }
 
-    char * src_code_raw;
-    char * dest_code_raw;
-    uint16_t price;
-    uint16_t day;
+    bool applies(move_type_t type, uint16_t i, uint16_t j) const {
+        uint64_t stamp = (*tabu[type])(i, j);
+        return stamp > epoch && stamp + tenure > iteration;
+    }
 
-    uint16_t days_total = 0;
+    int frequency(move_type_t type, uint16_t i, uint16_t j) const {
+        return (*freq[type])(i, j);
+    }
 
-    while(reader.read_row(src_code_raw, dest_code_raw, day, price)) {
-        uint16_t src_idx = 0;
-        uint16_t dest_idx = 0;
+    bool applies(const neighbour_t &neighbour) const {
+        return applies(neighbour.type, neighbour.key_i(), neighbour.key_j());
+    }
 
-        nodename_t src_code = {src_code_raw[0], src_code_raw[1], src_code_raw[2], 0};
-        nodename_t dest_code = {dest_code_raw[0], dest_code_raw[1], dest_code_raw[2], 0};
+    int frequency(const neighbour_t &neighbour) const {
+        return frequency(neighbour.type, neighbour.key_i(), neighbour.key_j());
+    }
 
-        if (node_name_map.count(src_code) == 0) {
-            src_idx = nodes.size();
-            node_name_map[src_code] = src_idx;
-            node_t *new_node = new node_t(src_code, src_idx);
-            nodes.push_back(new_node);
-        } else {
-            src_idx = node_name_map[src_code];
-        }
+    void record(const neighbour_t &neighbour) {
+        iteration++;
+        (*tabu[neighbour.type])(neighbour.key_i(), neighbour.key_j()) = iteration;
+        (*freq[neighbour.type])(neighbour.key_i(), neighbour.key_j())++;
+        if (neighbour.type == SWAP) swap_order.inc(neighbour.i, neighbour.j);
+        history[iteration % history.size()] = neighbour;
+    }
 
-        if (node_name_map.count(dest_code) == 0) {
-            dest_idx = nodes.size();
-            node_name_map[dest_code] = dest_idx;
-            node_t *new_node = new node_t(dest_code, dest_idx);
-            nodes.push_back(new_node);
-        } else {
-            dest_idx = node_name_map[dest_code];
-        }
+    // The move recorded last, valid once anything was recorded
+    const neighbour_t & last() const {
+        return history[iteration % history.size()];
+    }
 
-        route_t *route = new route_t(nodes[src_idx], nodes[dest_idx], price);
-        nodes[src_idx]->add_route(day, dest_idx, route);
+    // The move that stopped being tabu with the last record, NULL if none did
+    const neighbour_t * expired() const {
+        if (iteration <= tenure) return NULL;
 
-        if (days_total == 0 || price < minimal_price) minimal_price = price;
-        if (day >= days_total) days_total = day + 1;
+        uint64_t stamp = iteration - tenure;
+        const neighbour_t &move = history[stamp % history.size()];
+        if (stamp <= epoch || (*tabu[move.type])(move.key_i(), move.key_j()) != stamp) return NULL;
+        return &move;
     }
 
-    /*
-    // Resize all vectors
-    for (auto node_it = nodes.cbegin(); node_it != nodes.cend(); ++node_it) {
-        if ((*node_it)->routes.size() < days_total) (*node_it)->routes.resize(days_total);
-        for (auto day_it = (*node_it)->routes.begin(); day_it != (*node_it)->routes.end(); ++day_it) {
-            if (day_it->size() < days_total) day_it->resize(days_total, NULL);
-        }
-        
+    // Frequencies stay, they're what drives the diversification
+    void clear_tabu() {
+        epoch = iteration;
     }
-    */
 
-    start = nodes[node_name_map[start_code]];
+    uint64_t tenure;
+    uint64_t iteration;  // Moves recorded so far
+    uint64_t epoch;
+    std::vector<neighbour_t> history;  // Moves of the last tenure + 1 iterations
+    std::unique_ptr<semimatrix_t<uint64_t> > tabu[MOVE_TYPES];
+    std::unique_ptr<semimatrix_t<int> > freq[MOVE_TYPES];
+    frequency_order_t swap_order;
+};
+
+// End of the time budget. Reading the clock is cheap but not free, so
+// expired() only looks at it every `stride` calls and adapts the stride to
+// get about one reading per CHECK_PERIOD whatever one call costs.
+// Every thread needs its own copy.
+struct deadline_t {
+    typedef std::chrono::steady_clock clock_t;
 
-    return days_total;
-}
+    deadline_t(clock_t::time_point end) : end(end), last_check(clock_t::now()), stride(1), countdown(1) {};
+
+    bool expired() {
+        if (--countdown > 0) return false;
 
+        clock_t::time_point now = clock_t::now();
+        if (now >= end) {
+            countdown = 1;
+            return true;
+        }
 
-void cleanup(std::vector<node_t*> nodes) {
-    for (auto it_node = nodes.cbegin(); it_node != nodes.cend(); ++it_node) {
-        for (int i=0; i<90000; ++i) {
-            route_t * route = (*it_node)->routes[i];
-            if (route != NULL) delete route;
+        if (now - last_check < CHECK_PERIOD / 2 && stride < MAX_STRIDE) {
+            stride *= 2;
+        } else if (now - last_check > CHECK_PERIOD * 2 && stride > 1) {
+            stride /= 2;
         }
-        delete *it_node;
+        last_check = now;
+        countdown = stride;
+        return false;
     }
-}
 
-void display(std::vector<route_t *> path, int total_price) {
-    std::cout << total_price << std::endl;
+    static const std::chrono::microseconds CHECK_PERIOD;
+    static const uint32_t MAX_STRIDE = 1 << 16;
 
-    int i = 0;
-    for (auto it = path.cbegin(); it != path.cend(); ++it, ++i) {
-        std::cout << (*it)->src->name.data() << " " << (*it)->dest->name.data() << " " << i << " " << (*it)->price << std::endl;
-    }
-}
+    clock_t::time_point end;
+    clock_t::time_point last_check;
+    uint32_t stride;
+    uint32_t countdown;
+};
 
-void depth_search(node_t * start, uint16_t days_total,
-                  std::vector<route_t*> &path, int &total_price,
-                  bool full_scan) {
+const std::chrono::microseconds deadline_t::CHECK_PERIOD(500);
 
-    std::set<node_t *> visited_nodes;
-    node_t *current_node = start;
+// Used when neither --time-limit nor KIWI_TIME_LIMIT_MS is given
+const long DEFAULT_TIME_LIMIT_MS = 29000;
 
-    // Full scan variables
-    std::vector<route_t*> best_path;
-    int best_price = -1;
+// The construction may run this long after the reading even when the
+// reading used up the time limit, a late answer beats none
+const long MIN_CONSTRUCTION_MS = 100;
 
-    std::stack<stack_op_t> stack;
-    uint16_t day = 0;
-    visited_nodes.insert(start);
+// Paths up to this length are solved exactly unless --exact-max-days says
+// otherwise. Branch and bound first gets 1/EXACT_PROBE_SHARE of the budget
+// with the DFS path, if that doesn't prove it the tabu search gets
+// 1/EXACT_TABU_SHARE of the rest before branch and bound goes on.
+const int DEFAULT_EXACT_MAX_DAYS = 20;
+const int EXACT_PROBE_SHARE = 10;
+const int EXACT_TABU_SHARE = 10;
+
+// Best solution found by any of the tabu search threads
+struct shared_best_t {
+    shared_best_t(const std::vector<route_t*> &path, price_t price) : path(path), price(price) {};
+
+    bool publish(const std::vector<route_t*> &candidate, price_t candidate_price) {
+        // Most local improvements don't beat the global best, check without locking first
+        if (candidate_price >= price.load(std::memory_order_relaxed)) return false;
 
-    // Preload stack with routes of the first node
-    std::set<route_t*, route_ptr_compare_t> ordered_routes;  // Sort routes in set
-    for (int i = 0; i < 300; ++i) {
-        if (start->routes[i] != NULL) ordered_routes.insert(start->routes[i]);
+        std::lock_guard<std::mutex> guard(lock);
+        if (candidate_price >= price.load(std::memory_order_relaxed)) return false;
+        path = candidate;
+        price.store(candidate_price, std::memory_order_relaxed);
+        return true;
     }
-    for (auto it = ordered_routes.crbegin(); it != ordered_routes.crend(); ++it) {
-        stack.push(stack_op_t(FORTH, *it));
+
+    std::mutex lock;
+    std::vector<route_t*> path;
+    std::atomic<price_t> price;
+};
+
+// Fixed set of threads executing the same task, each on its own part.
+// The threads are kept between run() calls so they are cheap to use in
+// every tabu iteration.
+struct worker_pool_t {
+    worker_pool_t(unsigned int size) : task(NULL), generation(0), pending(0), stopping(false) {
+        // The thread calling run() works on part 0
+        for (unsigned int part = 1; part < size; ++part) {
+            threads.push_back(std::thread(&worker_pool_t::work, this, part));
+        }
     }
 
-    do {
-        if (stack.top().op == BACK) {
-            total_price -= stack.top().route->price;
-            visited_nodes.erase(path.back()->dest);
-            path.pop_back();
-            day--;
-            stack.pop();
-        } else {
-            day++;
-            route_t * this_route = stack.top().route;
-            path.push_back(this_route);
+    ~worker_pool_t() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+    }
 
-            node_t * this_node = this_route->dest;
-            visited_nodes.insert(this_node);
+    unsigned int size() const {
+        return threads.size() + 1;
+    }
 
-            total_price += this_route->price;
+    void run(const std::function<void(unsigned int)> &new_task) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            task = &new_task;
+            pending = threads.size();
+            generation++;
+        }
+        wake.notify_all();
 
-            stack.pop();
-            
-            stack.push(stack_op_t(BACK, this_route));
+        new_task(0);
 
-            if (day == days_total) {
-                if (full_scan) {
-                    if (best_price == -1 || best_price > total_price) {
-                        best_path = path;
-                        best_price = total_price;
-                        //display(best_path, best_price);
-                    }
-                } else {
-                    break;
-                }
+        std::unique_lock<std::mutex> guard(lock);
+        while (pending > 0) done.wait(guard);
+        task = NULL;
+    }
+
+    void work(unsigned int part) {
+        uint64_t seen_generation = 0;
+
+        while (true) {
+            const std::function<void(unsigned int)> *current_task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!stopping && generation == seen_generation) wake.wait(guard);
+                if (stopping) return;
+                seen_generation = generation;
+                current_task = task;
             }
 
-            std::set<route_t*, route_ptr_compare_t> ordered_routes;  // Sort routes in set
-            for (int i = 300 * day; i < 300 * (day + 1); ++i) {
-                if (this_node->routes[i] == NULL) continue;
-                if (
-                        (day == days_total - 1 && this_node->routes[i]->dest == start)
-                    ||
-                        !visited_nodes.count(this_node->routes[i]->dest)
-                    ) {
+            (*current_task)(part);
 
-                    ordered_routes.insert(this_node->routes[i]);
-                }
-            }
-            for (auto it = ordered_routes.crbegin(); it != ordered_routes.crend(); ++it) {
-                stack.push(stack_op_t(FORTH, *it));
-            }
+            std::lock_guard<std::mutex> guard(lock);
+            if (--pending == 0) done.notify_one();
         }
-    } while (!stack.empty());
-
-    if (day != days_total && !(full_scan && best_price != -1)) {
-        std::cerr << "Stack depleted, no circle" << std::endl;
     }
 
-    if (full_scan) {
-        path = best_path;
-        total_price = best_price;
-    }
-}
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    const std::function<void(unsigned int)> *task;
+    uint64_t generation;
+    unsigned int pending;
+    bool stopping;
+};
 
+// Largest price_table_t built unless --dense-prices-mb says otherwise, 0 disables it
+const size_t DENSE_PRICES_DEFAULT_LIMIT = 512 << 20;
+
+// Neighbourhoods of shorter paths are evaluated faster than threads wake up
+const uint16_t PARALLEL_NEIGHBOURHOOD_MIN_DAYS = 64;
+
+// From this many days on segment moves are evaluated every
+// days / SEGMENT_SHARE iterations by default
+const uint16_t SEGMENT_SCHEDULE_MIN_DAYS = 100;
+const int SEGMENT_SHARE = 8;
+
+// From this many days on only the DEFAULT_CANDIDATES best partners of every
+// row of the swap cache are priced between refills, see swap_cache_t, and
+// segments are moved and reversed over at most CANDIDATE_SEGMENT_SPAN days
+const uint16_t CANDIDATE_LIST_MIN_DAYS = 100;
+const uint16_t DEFAULT_CANDIDATES = 8;
+const uint16_t CANDIDATE_SEGMENT_SPAN = 16;
+
+// Iterations without a new best price before the search is kicked, and how
+// many of the least used swaps a kick applies, at least KICK_MIN_SWAPS
+const int DEFAULT_STAGNATION = 400;
+const int KICK_SHARE = 16;
+const unsigned int KICK_MIN_SWAPS = 2;
+
+// Best solutions kept as restart points, a restart happens after that many
+// kicks in a row didn't lead to a new best price
+const size_t DEFAULT_ELITE_SIZE = 4;
+const int KICKS_BEFORE_RESTART = 4;
+
+// Knobs of the tabu search
+struct search_options_t {
+    search_options_t() : moves(ALL_MOVES), segment_period(0), candidates(DEFAULT_CANDIDATES),
+        stagnation(DEFAULT_STAGNATION), elite_size(DEFAULT_ELITE_SIZE) {};
+
+    unsigned int moves;
+    int segment_period;  // 0 picks it by the number of days
+    uint16_t candidates; // Swap partners per row on long horizons, 0 keeps all
+    int stagnation;      // 0 never kicks
+    size_t elite_size;   // 0 never restarts
+};
 
-neighbour_t find_best_neighbour(uint16_t days_total,
-                                int current_price,
-                                std::vector<route_t*> &path,
-                                int best_price,
-                                semimatrix_t * tabu, semimatrix_t * freq,
-                                uint16_t minimal_price) {
 
-    std::set<std::pair<int, neighbour_t>, penalized_neighbour_compare_t> penalized_neighbours;
-    neighbour_t best_neighbour = {0,0,0};
+// Days and prices that don't fit their uint16_t are rejected with the line
+typedef io::CSVReader<4, io::trim_chars<>, io::no_quote_escape<' '>, io::throw_on_overflow > input_reader_t;
 
-    for (uint16_t i = 2; i < days_total - 1; ++i) {
-        for (uint16_t j = 1; j < i; ++j) {
-            if (i == j) continue;
+// Input that reads fine but can't be a valid instance
+struct input_error_t : std::runtime_error {
+    // Either reader: input_reader_t or flight_scanner_t
+    template <typename reader_t>
+    input_error_t(const reader_t &reader, const std::string &message)
+        : std::runtime_error("Line " + std::to_string(reader.get_file_line()) + " in file \""
+                             + reader.get_truncated_file_name() + "\": " + message) {};
 
-            int neighbour_price = current_price;
-            /* TEST
-            int test_price=0;
-            for (int t=0; t<days_total; ++t){
-                test_price += path[t]->price;
-            }
-            assert(test_price == neighbour_price);
-            */
-            
-            route_t* old_i_left = path[i - 1];
-            route_t* old_i_right = path[i];
+    input_error_t(const std::string &file_name, const std::string &message)
+        : std::runtime_error("In file \"" + file_name + "\": " + message) {};
+};
 
-            route_t* old_j_left = path[j - 1];
-            route_t* old_j_right = path[j];
+// Node indices are uint16_t, and so is the day
+const size_t MAX_NODES = UINT16_MAX;
+const uint16_t MAX_DAYS = UINT16_MAX - 1;
 
-            node_t* node_i = path[i]->src;
-            node_t* node_j = path[j]->src;
+// One input line as read, before its airports get indices
+struct raw_flight_t {
+    nodename_t src_code, dest_code;
+    uint16_t day, price;
+};
 
-            route_t* new_i_left = old_j_left->src->get_route(j-1, node_i->idx);
-            route_t* new_i_right = node_i->get_route(j, old_j_right->dest->idx);
+// False at the end of the input
+bool read_flight(input_reader_t &reader, raw_flight_t &row) {
+    char * src_code_raw;
+    char * dest_code_raw;
+    if (!reader.read_row(src_code_raw, dest_code_raw, row.day, row.price)) return false;
 
-            route_t* new_j_left = old_i_left->src->get_route(i-1, node_j->idx);
-            route_t* new_j_right = node_j->get_route(i, old_i_right->dest->idx);
+    if (strlen(src_code_raw) != 3 || strlen(dest_code_raw) != 3) {
+        throw input_error_t(reader, "airport codes have 3 letters");
+    }
+    if (row.day > MAX_DAYS) throw input_error_t(reader, "day out of range");
 
-            if (new_i_left == NULL || new_i_right == NULL || new_j_left == NULL || new_j_right == NULL) {
-                // std::cerr << "Not a valid neighbour - route missing" << std::endl;
-                continue;
-            }
+    nodename_t src_code = {src_code_raw[0], src_code_raw[1], src_code_raw[2], 0};
+    nodename_t dest_code = {dest_code_raw[0], dest_code_raw[1], dest_code_raw[2], 0};
+    row.src_code = src_code;
+    row.dest_code = dest_code;
+    return true;
+}
 
-            neighbour_price -= (old_i_right->price + old_j_left->price + old_j_right->price);
-            if (i - j > 1) neighbour_price -= old_i_left->price;
+// Reads the "SRC DST DAY PRICE" lines without the generic CSV machinery.
+// Lines that fit 32 bytes are split with a single vector compare finding
+// the newline and the spaces, the numbers are converted eight bytes at a
+// time. Anything unusual (tabs, carriage returns, repeated spaces, long
+// lines, the end of the buffer) goes through a plain byte loop. Works on
+// memory it doesn't own, or reads blocks from a descriptor.
+struct flight_scanner_t {
+    static const size_t WINDOW = 32;
+    static const size_t READ_BLOCK = 1 << 20;
+
+    // first_line is the number of lines before begin
+    flight_scanner_t(const std::string &file_name, const char * begin, const char * end, unsigned first_line = 0)
+        : file_name(file_name), fd(-1), pos(begin), limit(end), eof(true), line(first_line),
+          use_avx2(cpu_has_avx2()) {};
+
+    flight_scanner_t(const std::string &file_name, int fd)
+        : file_name(file_name), fd(fd), pos(NULL), limit(NULL), eof(false), line(0),
+          use_avx2(cpu_has_avx2()) {};
+
+    flight_scanner_t(const flight_scanner_t &) = delete;
+    flight_scanner_t & operator = (const flight_scanner_t &) = delete;
+
+    const char * get_truncated_file_name() const {
+        return file_name.c_str();
+    }
 
-            neighbour_price += (new_i_right->price + new_j_left->price + new_j_right->price);
-            if (i - j > 1) neighbour_price += new_i_left->price;
+    unsigned get_file_line() const {
+        return line;
+    }
 
+    // The first line trimmed, NULL at the end of the input
+    char * next_line() {
+        const char *first, *last;
+        if (!take_line(first, last)) return NULL;
+        trim(first, last);
+        start_line.assign(first, last);
+        return &start_line[0];
+    }
 
-            if (tabu->applies(i, j)) {
-                //std::cerr << "Neighbour in tabu" << std::endl;
-                if (neighbour_price < best_price) {
-                    //std::cerr << "Tabu cancelled - Aspiration criteria met" << std::endl;
-                } else {
-                    continue;
-                }
-            }
+    // False at the end of the input, throws input_error_t on a bad line
+    bool read_row(raw_flight_t &row) {
+        while (true) {
+            if (limit - pos >= (ptrdiff_t) (WINDOW + sizeof(uint64_t)) && read_row_fast(row)) return true;
+
+            const char *first, *last;
+            if (!take_line(first, last)) return false;
+            trim(first, last);
+            if (first == last) continue;  // Blank lines are skipped
+            read_row_slow(first, last, row);
+            return true;
+        }
+    }
 
-            penalized_neighbours.insert(std::pair<int, neighbour_t>(neighbour_price + minimal_price * freq->get(i, j), neighbour_t(i, j, neighbour_price)));
+    // Newline and space positions in the 32 bytes at p
+    void scan(const char * p, uint32_t &newlines, uint32_t &spaces) const {
+#ifdef KIWI_X86
+        if (use_avx2) {
+            scan_avx2(p, newlines, spaces);
+            return;
+        }
+#endif
+#ifdef __SSE2__
+        scan_sse2(p, newlines, spaces);
+#else
+        newlines = spaces = 0;
+        for (unsigned k = 0; k < WINDOW; ++k) {
+            newlines |= (uint32_t) (p[k] == '\n') << k;
+            spaces |= (uint32_t) (p[k] == ' ') << k;
+        }
+#endif
+    }
 
-            if (best_neighbour.i == 0 || best_neighbour.price > neighbour_price) {
-                best_neighbour.i = i;
-                best_neighbour.j = j;
-                best_neighbour.price = neighbour_price;
+#ifdef KIWI_X86
+    __attribute__((target("avx2")))
+    static void scan_avx2(const char * p, uint32_t &newlines, uint32_t &spaces) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) p);
+        newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+        spaces = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')));
+    }
 
-                /* TEST
-                int test_price=0;
-                for (int t=0; t<days_total; ++t){
-                    if (t == i) test_price += new_i_right->price;
-                    else if (t == j - 1) test_price += new_j_left->price;
-                    else if (t == j) test_price += new_j_right->price;
-                    else if (t == i - 1) test_price += new_i_left->price;
-                    else test_price += path[t]->price;
-                }
+#endif
+
+#ifdef __SSE2__
+    static void scan_sse2(const char * p, uint32_t &newlines, uint32_t &spaces) {
+        __m128i low = _mm_loadu_si128((const __m128i *) p);
+        __m128i high = _mm_loadu_si128((const __m128i *) (p + 16));
+        __m128i newline = _mm_set1_epi8('\n');
+        __m128i space = _mm_set1_epi8(' ');
+        newlines = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(low, newline))
+                 | (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(high, newline)) << 16;
+        spaces = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(low, space))
+               | (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(high, space)) << 16;
+    }
+#endif
+
+    // The common line: 3 letter codes and single spaces, ending in '\n'
+    // within the window. False leaves everything as it was.
+    bool read_row_fast(raw_flight_t &row) {
+        uint32_t newlines, spaces;
+        scan(pos, newlines, spaces);
+        if (newlines == 0) return false;
+
+        unsigned end = __builtin_ctz(newlines);
+        spaces &= ((uint32_t) 1 << end) - 1;
+        if ((spaces & 0xff) != 0x88 || __builtin_popcount(spaces) != 3) return false;
+        unsigned price_start = __builtin_ctz(spaces & ~(uint32_t) 0xff) + 1;
+
+        for (int k = 0; k < 7; ++k) {
+            if (k != 3 && (unsigned char) pos[k] <= ' ') return false;
+        }
+
+        uint32_t day, price;
+        if (!parse_digits(pos + 8, price_start - 9, day) || day > MAX_DAYS ||
+            !parse_digits(pos + price_start, end - price_start, price) || price > UINT16_MAX) {
+            return false;
+        }
 
-                if (test_price != neighbour_price) {
-                    std::cerr << "Fuck up " << neighbour_price << " vs " << test_price << std::endl;
-                    std::cerr << "i=" << i << " j=" << j << std::endl;
-                    assert(false);
-                }*/
+        nodename_t src_code = {pos[0], pos[1], pos[2], 0};
+        nodename_t dest_code = {pos[4], pos[5], pos[6], 0};
+        row.src_code = src_code;
+        row.dest_code = dest_code;
+        row.day = day;
+        row.price = price;
 
-            }
+        pos += end + 1;
+        line++;
+        return true;
+    }
 
+    // 1 to 8 digits, p must be readable for 8 bytes
+    static bool parse_digits(const char * p, unsigned length, uint32_t &value) {
+        if (length < 1 || length > 8) return false;
+
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        // The digits go to the top bytes, the rest become leading zeros
+        unsigned shift = 8 * (8 - length);
+        uint64_t used = ~(uint64_t) 0 << shift;
+        chunk = (chunk << shift) & used;
+
+        uint64_t zeros = 0x3030303030303030ULL & used;
+        uint64_t nibbles = (chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+                           (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4);
+        if ((nibbles & used) != (0x3333333333333333ULL & used)) return false;
+
+        chunk -= zeros;
+        chunk = chunk * 10 + (chunk >> 8);
+        chunk = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+                 (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+        value = chunk;
+        return true;
+    }
 
+    // Any line: fields separated by spaces or tabs, maybe a '\r' at the end
+    void read_row_slow(const char * first, const char * last, raw_flight_t &row) {
+        const char *field[4];
+        size_t length[4];
+        int fields = 0;
+        const char *p = first;
+        while (p != last) {
+            if (fields == 4) throw input_error_t(*this, "more than 4 columns");
+            field[fields] = p;
+            while (p != last && *p != ' ' && *p != '\t') ++p;
+            length[fields] = p - field[fields];
+            fields++;
+            while (p != last && (*p == ' ' || *p == '\t')) ++p;
         }
+        if (fields < 4) throw input_error_t(*this, "fewer than 4 columns");
+
+        if (length[0] != 3 || length[1] != 3) throw input_error_t(*this, "airport codes have 3 letters");
+        nodename_t src_code = {field[0][0], field[0][1], field[0][2], 0};
+        nodename_t dest_code = {field[1][0], field[1][1], field[1][2], 0};
+        row.src_code = src_code;
+        row.dest_code = dest_code;
+
+        uint32_t day = parse_number(field[2], length[2]);
+        if (day > MAX_DAYS) throw input_error_t(*this, "day out of range");
+        uint32_t price = parse_number(field[3], length[3]);
+        if (price > UINT16_MAX) throw input_error_t(*this, "price out of range");
+        row.day = day;
+        row.price = price;
     }
 
-    //std::cerr << "Returning best neighbour with price " << best_neighbour.price << std::endl;
-    //std::cerr << "i=" << best_neighbour.i << " j=" << best_neighbour.j << std::endl;
+    uint32_t parse_number(const char * p, size_t length) {
+        uint32_t value = 0;
+        for (size_t k = 0; k < length; ++k) {
+            uint32_t digit = (unsigned char) p[k] - '0';
+            if (digit > 9) throw input_error_t(*this, "not a number");
+            value = value * 10 + digit;
+            if (value > UINT16_MAX) value = UINT16_MAX + 1;  // Out of range anyway
+        }
+        return value;
+    }
 
-    if (days_total > 200) return best_neighbour; //jinak to nestihne
-    
-    if (best_neighbour.i == 0) {
-        // No applicable neighbours
-        return best_neighbour;
+    static void trim(const char * &first, const char * &last) {
+        while (first != last && (*first == ' ' || *first == '\t')) ++first;
+        while (last != first && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r')) --last;
     }
 
-    if (best_neighbour.price < best_price) {
-        return best_neighbour;
-    } else {
-        /*
-        std::cerr << "No interesting neighbour, picking by frequency-penalized price" << std::endl;
-        std::cerr << penalized_neighbours.cbegin()->second.i << std::endl;
-        std::cerr << penalized_neighbours.crbegin()->second.j << std::endl;
-        */
-        return penalized_neighbours.cbegin()->second;
+    // Next line without its '\n', false at the end of the input
+    bool take_line(const char * &first, const char * &last) {
+        const char *newline;
+        while ((newline = pos != limit ? (const char *) memchr(pos, '\n', limit - pos) : NULL) == NULL && !eof) {
+            refill();
+        }
+        if (pos == limit && eof) return false;
+
+        first = pos;
+        last = newline != NULL ? newline : limit;
+        pos = newline != NULL ? newline + 1 : limit;
+        line++;
+        return true;
+    }
+
+    // Keeps the unread part and appends the next block from the descriptor
+    void refill() {
+        size_t kept = limit - pos;
+        if (kept > 0 && pos != buffer.data()) memmove(&buffer[0], pos, kept);
+        if (buffer.size() < kept + READ_BLOCK) buffer.resize(kept + READ_BLOCK);
+
+        ssize_t got;
+        do {
+            got = read(fd, &buffer[kept], buffer.size() - kept);
+        } while (got < 0 && errno == EINTR);
+        if (got < 0) throw input_error_t(*this, std::string("can't read: ") + strerror(errno));
+
+        if (got == 0) eof = true;
+        pos = buffer.data();
+        limit = pos + kept + std::max<ssize_t>(got, 0);
     }
 
+    std::string file_name;
+    int fd;                   // -1 when reading from memory
+    std::vector<char> buffer;
+    const char *pos, *limit;  // Unread input
+    bool eof;                 // Nothing more behind limit
+    unsigned line;
+    std::string start_line;
+    bool use_avx2;
+};
 
+bool read_flight(flight_scanner_t &scanner, raw_flight_t &row) {
+    return scanner.read_row(row);
 }
 
-void recalculate_price(std::vector<route_t*> path, int * price) {
-    *price = 0;
-    for (auto it = path.cbegin(); it != path.cend(); ++it) {
-        *price += (*it)->price;
+// Airport codes to indices. Codes of three capital letters, which is all
+// of them in practice, are looked up in a table by the letters, anything
+// else goes through a map.
+struct airport_index_t {
+    static const uint16_t ABSENT = UINT16_MAX;  // Above any index, MAX_NODES is the count
+    static const size_t LETTER_CODES = 26 * 26 * 26;
+
+    airport_index_t() : letters(LETTER_CODES, ABSENT) {};
+
+    // -1 if not all letters are capital
+    static int letter_key(const nodename_t &code) {
+        unsigned a = (unsigned char) code[0] - 'A';
+        unsigned b = (unsigned char) code[1] - 'A';
+        unsigned c = (unsigned char) code[2] - 'A';
+        if (a >= 26 || b >= 26 || c >= 26) return -1;
+        return (a * 26 + b) * 26 + c;
     }
-}
 
+    uint16_t find(const nodename_t &code) const {
+        int key = letter_key(code);
+        if (key >= 0) return letters[key];
 
-void tabu_search(node_t * start, uint16_t days_total, std::vector<route_t*> &best_path,
-                 int &best_price, uint16_t minimal_price) {
+        auto found = others.find(code);
+        return found != others.end() ? found->second : ABSENT;
+    }
 
-    std::vector<route_t*> current_path = best_path;
-    int current_price = best_price;
+    void insert(const nodename_t &code, uint16_t idx) {
+        int key = letter_key(code);
+        if (key >= 0) {
+            letters[key] = idx;
+        } else {
+            others[code] = idx;
+        }
+    }
 
-    semimatrix_t tabu(days_total - 1, days_total - 1);
-    semimatrix_t freq(days_total - 1, days_total - 1);
+    std::vector<uint16_t> letters;
+    std::unordered_map<nodename_t, uint16_t, nodename_hash_t> others;
+};
 
-    int iter_since_improvement = 0;
+// Flights of every source airport in input order, collected as the lines
+// arrive so that build_graph() works on one airport at a time
+struct flight_buckets_t {
+    flight_buckets_t(const std::string &file_name, arena_t &arena, std::vector<node_t*> &nodes)
+        : file_name(file_name), arena(arena), nodes(nodes), flight_count(0),
+          days_total(0), minimal_price(0) {};
+
+    uint16_t intern(const nodename_t &code) {
+        uint16_t found = airports.find(code);
+        if (found != airport_index_t::ABSENT) return found;
+
+        if (nodes.size() >= MAX_NODES) throw input_error_t(file_name, "too many airports");
+        uint16_t idx = nodes.size();
+        airports.insert(code, idx);
+        nodes.push_back(arena.make<node_t>(code, idx));
+        by_src.push_back(std::vector<flight_t>());
+        return idx;
+    }
 
-    while (difftime(time(NULL), started) < 29) {
-        neighbour_t neighbour = find_best_neighbour(days_total, current_price,
-                                                    current_path, best_price,
-                                                    &tabu, &freq,
-                                                    minimal_price);
+    flight_t add(const raw_flight_t &row) {
+        uint16_t src_idx = intern(row.src_code);
+        uint16_t dest_idx = intern(row.dest_code);
 
-        if (neighbour.i != 0) {
-            neighbour.apply(current_path);
-            tabu.set(neighbour.i, neighbour.j);
-            freq.inc(neighbour.i, neighbour.j);
-            current_price = neighbour.price;
-            if (neighbour.price < best_price) {
-                iter_since_improvement = 0;
-                best_path = current_path;
-                best_price = current_price;
-                //display(current_path, neighbour.price);
-            } else {
-                iter_since_improvement++;
-            }
-        } else {
-            //std::cerr << "No applicable neighbour" << std::endl;
-        }
+        flight_t flight = {src_idx, dest_idx, row.day, row.price};
+        by_src[src_idx].push_back(flight);
 
-/*
-        if (iter_since_improvement > 400) {
-            bool applied = false;
-            while (!applied && difftime(time(NULL), started) < 29) {
-                neighbour_t neighbour(0,0,0);
-                freq.get_minimum(&neighbour.i, &neighbour.j);
-                applied = neighbour.try_apply(current_path);
-                //if (!applied) std::cout << "not applicable" << std::endl;
-            }
-            if (applied) {
-                tabu.clear();
-                freq.clear();
-                iter_since_improvement++;
-                recalculate_price(current_path, &current_price);
-            }
-        }
-*/
+        if (flight_count == 0 || row.price < minimal_price) minimal_price = row.price;
+        if (row.day >= days_total) days_total = row.day + 1;
+        flight_count++;
+        return flight;
     }
-    //display(best_path, best_price);
 
-}
+    std::string file_name;
+    arena_t &arena;
+    std::vector<node_t*> &nodes;
+    airport_index_t airports;
+    std::vector<std::vector<flight_t> > by_src;
+    size_t flight_count;
+    uint16_t days_total;
+    uint16_t minimal_price;
+};
 
+// Lines parsed by one thread and added to the buckets by another travel in
+// a ring of CHUNKS chunks, so the parser is never more than that ahead
+struct row_pipe_t {
+    static const size_t CHUNKS = 8;
+    static const size_t CHUNK_ROWS = 1 << 14;
 
-int main(int argc, char **argv) {
+    row_pipe_t() : chunks(CHUNKS), filled(0), consumed(0), done(false), aborted(false) {
+        for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+            it->reserve(CHUNK_ROWS);
+        }
+    }
 
-    std::vector<node_t*> nodes;
-    node_t* start;
-    uint16_t minimal_price = 0;
-    //std::cerr << "Loading " << std::endl;
-    uint16_t days_total = read_input(nodes, start, minimal_price);
-    //std::cerr << "Loading done" << std::endl;
+    // Parsing side, NULL once the other side gave up
+    std::vector<raw_flight_t> * next_free() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!aborted && filled - consumed == CHUNKS) changed.wait(guard);
+        if (aborted) return NULL;
+        std::vector<raw_flight_t> *chunk = &chunks[filled % CHUNKS];
+        chunk->clear();
+        return chunk;
+    }
 
-    std::vector<route_t *> path;
-    int total_price = 0;
+    void push() {
+        std::lock_guard<std::mutex> guard(lock);
+        filled++;
+        changed.notify_all();
+    }
+
+    void finish(std::exception_ptr failure) {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        error = failure;
+        changed.notify_all();
+    }
 
-    bool full_scan = days_total <= 20;
-    full_scan = false;
+    // Building side, NULL after the last chunk
+    std::vector<raw_flight_t> * next_full() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (consumed == filled && !done) changed.wait(guard);
+        if (consumed == filled) return NULL;
+        return &chunks[consumed % CHUNKS];
+    }
 
-    depth_search(start, days_total, path, total_price, full_scan);
-    //display(path, total_price);
+    void release() {
+        std::lock_guard<std::mutex> guard(lock);
+        consumed++;
+        changed.notify_all();
+    }
 
-    if (!full_scan) {
-        tabu_search(start, days_total, path, total_price, minimal_price);
+    void abort() {
+        std::lock_guard<std::mutex> guard(lock);
+        aborted = true;
+        changed.notify_all();
     }
 
-    display(path, total_price);
+    std::vector<std::vector<raw_flight_t> > chunks;
+    std::mutex lock;
+    std::condition_variable changed;
+    uint64_t filled, consumed;
+    bool done, aborted;
+    std::exception_ptr error;  // Thrown by the parser
+};
 
-    cleanup(nodes);
+// Depth-first construction that starts while the flights are still read.
+// They are bucketed by day as they arrive, and a day counts as read once a
+// flight of a later day shows up. On input in day order, which is how
+// generators and feeds write it, the DFS goes through the first days while
+// the rest is still streaming in. It tries the routes in the order of
+// depth_search() on the built graph, so it finds the same path. A flight of
+// a day the DFS already took means the input isn't in day order: the early
+// construction gives up and depth_search() runs once the graph is built.
+// The thread stays for the next instance, start() hands it one.
+struct early_construction_t {
+    enum status_t { RUNNING, FOUND, DEPLETED, OUT_OF_TIME, GAVE_UP };
+
+    // Flights of a day by source, those of a source by (price, destination)
+    struct day_t {
+        day_t() : taken(false) {};
+
+        const flight_t * begin(uint16_t src_idx) const {
+            return flights.data() + (src_idx + 1u < src_start.size() ? src_start[src_idx] : 0);
+        }
 
-    return 0;
-}
+        const flight_t * end(uint16_t src_idx) const {
+            return flights.data() + (src_idx + 1u < src_start.size() ? src_start[src_idx + 1] : 0);
+        }
 
-bool route_ptr_compare_t::operator () (const route_t* const &lhs, const route_t* const &rhs) const {
-    return lhs->price < rhs->price;
-}
+        std::vector<flight_t> flights;
+        std::vector<uint32_t> src_start;
+        bool taken;  // By the DFS, no more flights may arrive
+    };
 
-bool penalized_neighbour_compare_t::operator () (const std::pair<int,neighbour_t> &lhs, const std::pair<int,neighbour_t> &rhs) const {
-    return lhs.first < rhs.first;
+    struct frame_t {
+        const flight_t *next, *end;
+    };
+
+    early_construction_t() : start_idx(airport_index_t::ABSENT), reading(false), status(GAVE_UP), stop(true),
+        running(false), generation(0), quitting(false) {
+        worker = std::thread(&early_construction_t::serve_runs, this);
+    }
+
+    early_construction_t(const early_construction_t &) = delete;
+    early_construction_t & operator = (const early_construction_t &) = delete;
+
+    ~early_construction_t() {
+        cancel();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            quitting = true;
+            changed.notify_all();
+        }
+        worker.join();
+    }
+
+    // Reading side, before the first flight of an instance
+    void start() {
+        cancel();
+
+        std::lock_guard<std::mutex> guard(lock);
+        start_idx = airport_index_t::ABSENT;
+        reading = true;
+        status = RUNNING;
+        stop = false;
+        current.clear();
+        found.clear();
+        running = true;
+        generation++;
+        changed.notify_all();
+    }
+
+    // Stops the DFS of the last instance, if it's still going, and lets go
+    // of its flights
+    void cancel() {
+        std::unique_lock<std::mutex> guard(lock);
+        stop = true;
+        changed.notify_all();
+        while (running) changed.wait(guard);
+        std::deque<day_t>().swap(days);
+    }
+
+    // Reading side, start is the index of the start airport once it has one
+    void add(const std::vector<flight_t> &flights, uint16_t start) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (status == GAVE_UP) return;
+
+        start_idx = start;
+        for (auto it = flights.cbegin(); it != flights.cend(); ++it) {
+            if (it->day >= days.size()) days.resize(it->day + 1);
+            day_t &day = days[it->day];
+            if (day.taken) {
+                status = GAVE_UP;
+                stop = true;
+                break;
+            }
+            if (status == RUNNING) day.flights.push_back(*it);
+        }
+        changed.notify_all();
+    }
+
+    void finish_reading() {
+        std::lock_guard<std::mutex> guard(lock);
+        reading = false;
+        changed.notify_all();
+    }
+
+    // Waits for the DFS until end. Once it found a path, that's set up with
+    // the routes of the built graph.
+    status_t finish(const std::vector<node_t*> &nodes, deadline_t::clock_t::time_point end,
+                    std::vector<route_t*> &path, price_t &total_price) {
+        std::unique_lock<std::mutex> guard(lock);
+        while (status == RUNNING && changed.wait_until(guard, end) != std::cv_status::timeout) {}
+        if (status == RUNNING) {
+            status = OUT_OF_TIME;
+            stop = true;
+        }
+        status_t result = status;
+        while (running) changed.wait(guard);
+        std::deque<day_t>().swap(days);
+        guard.unlock();
+
+        if (result != FOUND) return result;
+        for (auto it = found.cbegin(); it != found.cend(); ++it) {
+            route_t *route = nodes[it->src_idx]->get_route(it->day, it->dest_idx);
+            if (route == NULL || route->price != it->price) {
+                path.clear();
+                total_price = 0;
+                return GAVE_UP;
+            }
+            path.push_back(route);
+            total_price += route->price;
+        }
+        return FOUND;
+    }
+
+    // The flights of day d once all of them are read, NULL when the DFS
+    // has to stop. last tells whether it's the last day.
+    const day_t * take_day(uint16_t d, bool &last, uint16_t &start) {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stop && reading && (size_t) d + 1 >= days.size()) changed.wait(guard);
+        if (stop || d >= days.size()) return NULL;
+
+        last = !reading && (size_t) d + 1 == days.size();
+        start = start_idx;
+        day_t &day = days[d];
+        day.taken = true;
+        guard.unlock();
+
+        sort_day(day);
+        return &day;
+    }
+
+    // Counting sort by source, then each source's flights are few
+    static void sort_day(day_t &day) {
+        std::vector<flight_t> &flights = day.flights;
+        uint16_t sources = 0;
+        for (auto it = flights.cbegin(); it != flights.cend(); ++it) {
+            sources = std::max<uint16_t>(sources, it->src_idx + 1);
+        }
+
+        std::vector<uint32_t> &start = day.src_start;
+        start.assign(sources + 1, 0);
+        for (auto it = flights.cbegin(); it != flights.cend(); ++it) {
+            start[it->src_idx + 1]++;
+        }
+        for (size_t src_idx = 0; src_idx < sources; ++src_idx) {
+            start[src_idx + 1] += start[src_idx];
+        }
+        std::vector<flight_t> by_src(flights.size());
+        for (auto it = flights.cbegin(); it != flights.cend(); ++it) {
+            by_src[start[it->src_idx]++] = *it;
+        }
+
+        // start[src_idx] is the end of the source now. The later input line
+        // for the same flight wins, as in build_graph().
+        uint32_t kept = 0, first = 0;
+        for (size_t src_idx = 0; src_idx < sources; ++src_idx) {
+            auto begin = by_src.begin() + first, end = by_src.begin() + start[src_idx];
+            std::stable_sort(begin, end, [](const flight_t &a, const flight_t &b) {
+                return a.dest_idx < b.dest_idx;
+            });
+            first = start[src_idx];
+            start[src_idx] = kept;
+            for (auto it = begin; it != end; ++it) {
+                if (it + 1 != end && (it + 1)->dest_idx == it->dest_idx) continue;
+                flights[kept++] = *it;
+            }
+            std::sort(flights.begin() + start[src_idx], flights.begin() + kept, [](const flight_t &a, const flight_t &b) {
+                return a.price != b.price ? a.price < b.price : a.dest_idx < b.dest_idx;
+            });
+        }
+        start[sources] = kept;
+        flights.resize(kept);
+    }
+
+    void done(status_t result) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (status == RUNNING) status = result;
+        changed.notify_all();
+    }
+
+    // The worker, one run() per start()
+    void serve_runs() {
+        uint64_t seen_generation = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!quitting && generation == seen_generation) changed.wait(guard);
+                if (quitting) return;
+                seen_generation = generation;
+            }
+
+            run();
+
+            std::lock_guard<std::mutex> guard(lock);
+            running = false;
+            changed.notify_all();
+        }
+    }
+
+    // depth_search() on the days taken so far, the mutex is only taken
+    // once per day
+    void run() {
+        std::vector<const day_t *> taken;
+        std::vector<uint8_t> last;
+        std::vector<frame_t> frames;
+        node_set_t visited(MAX_NODES);
+        uint16_t start = airport_index_t::ABSENT;
+
+        auto take = [&](uint16_t d) {
+            bool is_last;
+            const day_t *day = take_day(d, is_last, start);
+            if (day == NULL) return false;
+            taken.push_back(day);
+            last.push_back(is_last);
+            frames.push_back(frame_t());
+            return true;
+        };
+
+        // Stopped, or nothing was read at all, which the reading reports
+        if (!take(0)) {
+            done(GAVE_UP);
+            return;
+        }
+        if (start == airport_index_t::ABSENT) {
+            done(DEPLETED);
+            return;
+        }
+
+        uint16_t d = 0;
+        visited.insert(start);
+        frames[0].next = taken[0]->begin(start);
+        frames[0].end = taken[0]->end(start);
+
+        while (true) {
+            if (stop.load(std::memory_order_relaxed)) return;
+
+            frame_t &frame = frames[d];
+            while (frame.next != frame.end &&
+                    (last[d] ? frame.next->dest_idx != start : visited.contains(frame.next->dest_idx))) {
+                ++frame.next;
+            }
+
+            if (frame.next == frame.end) {
+                if (d == 0) {
+                    done(DEPLETED);
+                    return;
+                }
+
+                // All routes of this day tried, step back
+                d--;
+                visited.erase(current.back().dest_idx);
+                current.pop_back();
+                continue;
+            }
+
+            const flight_t &flight = *frame.next++;
+            current.push_back(flight);
+            if (last[d]) break;
+
+            d++;
+            if (d == taken.size() && !take(d)) {
+                done(GAVE_UP);
+                return;
+            }
+            visited.insert(flight.dest_idx);
+            frames[d].next = taken[d]->begin(flight.dest_idx);
+            frames[d].end = taken[d]->end(flight.dest_idx);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        found.swap(current);
+        if (status == RUNNING) status = FOUND;
+        changed.notify_all();
+    }
+
+    std::deque<day_t> days;         // Elements stay where they are as more days arrive
+    uint16_t start_idx;
+    bool reading;
+    status_t status;
+    std::atomic<bool> stop;
+    std::vector<flight_t> current;  // Path of the DFS
+    std::vector<flight_t> found;    // The path once it's complete
+    bool running;                   // run() hasn't returned since start()
+    uint64_t generation;            // Of start() calls
+    bool quitting;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread worker;
+};
+
+// Threads a solver keeps between the instances it solves, like its
+// solver_buffers_t, so that a batch or a server doesn't start and join them
+// for every instance. Each kind is started when it's first needed.
+struct solver_threads_t {
+    solver_threads_t(unsigned int threads, unsigned int eval_threads, unsigned int ingest_threads)
+        : threads(threads), eval_threads(eval_threads), ingest_threads(ingest_threads), eval_pools(threads) {};
+
+    // The search threads, the caller is one of them
+    worker_pool_t &search() {
+        if (!search_pool) search_pool.reset(new worker_pool_t(threads));
+        return *search_pool;
+    }
+
+    // Of search thread t, NULL when the neighbourhood isn't split
+    worker_pool_t * eval(unsigned int t) {
+        if (eval_threads <= 1) return NULL;
+        if (!eval_pools[t]) eval_pools[t].reset(new worker_pool_t(eval_threads));
+        return eval_pools[t].get();
+    }
+
+    // Parse the pieces of a large input
+    worker_pool_t &ingest() {
+        if (!ingest_pool) ingest_pool.reset(new worker_pool_t(ingest_threads));
+        return *ingest_pool;
+    }
+
+    // Part 1 parses a pipelined input, part 0 is the caller
+    worker_pool_t &parser() {
+        if (!parser_pool) parser_pool.reset(new worker_pool_t(2));
+        return *parser_pool;
+    }
+
+    early_construction_t &early() {
+        if (!early_construction) early_construction.reset(new early_construction_t());
+        return *early_construction;
+    }
+
+    unsigned int threads, eval_threads, ingest_threads;
+    std::unique_ptr<worker_pool_t> search_pool, ingest_pool, parser_pool;
+    std::vector<std::unique_ptr<worker_pool_t> > eval_pools;
+    std::unique_ptr<early_construction_t> early_construction;
+};
+
+// Parses on the second thread of parser while the calling thread interns
+// the airports and buckets the flights, errors of either side are rethrown
+// here. The flights also go to the early construction unless that's NULL.
+template <typename reader_t>
+void read_flights_pipelined(reader_t &reader, flight_buckets_t &buckets, worker_pool_t &parser,
+                            early_construction_t *early, const nodename_t &start_code) {
+    row_pipe_t pipe;
+    std::exception_ptr build_failure;
+
+    parser.run([&](unsigned int part) {
+        if (part == 1) {
+            std::exception_ptr failure;
+            try {
+                bool more = true;
+                while (more) {
+                    std::vector<raw_flight_t> *chunk = pipe.next_free();
+                    if (chunk == NULL) break;
+
+                    raw_flight_t row;
+                    while (chunk->size() < row_pipe_t::CHUNK_ROWS && (more = read_flight(reader, row))) {
+                        chunk->push_back(row);
+                    }
+                    pipe.push();
+                }
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            pipe.finish(failure);
+            return;
+        }
+
+        std::vector<flight_t> added;
+        try {
+            while (std::vector<raw_flight_t> *chunk = pipe.next_full()) {
+                added.clear();
+                for (auto it = chunk->cbegin(); it != chunk->cend(); ++it) {
+                    flight_t flight = buckets.add(*it);
+                    if (early != NULL) added.push_back(flight);
+                }
+                pipe.release();
+                if (early != NULL) early->add(added, buckets.airports.find(start_code));
+            }
+        } catch (...) {
+            build_failure = std::current_exception();
+            pipe.abort();
+        }
+    });
+
+    if (build_failure) std::rethrow_exception(build_failure);
+    if (pipe.error) std::rethrow_exception(pipe.error);
+}
+
+// Below this many bytes per thread an input isn't worth splitting
+const size_t INGEST_CHUNK_MIN_BYTES = 1 << 20;
+
+// Flights of one piece of the input, the airports are numbered in the
+// order they appear in the piece until the pieces get merged
+struct chunk_flights_t {
+    chunk_flights_t() : begin(NULL), end(NULL), lines(0), days_total(0), minimal_price(0) {};
+
+    uint16_t intern(const nodename_t &code, const std::string &file_name) {
+        uint16_t found = airports.find(code);
+        if (found != airport_index_t::ABSENT) return found;
+
+        if (codes.size() >= MAX_NODES) throw input_error_t(file_name, "too many airports");
+        uint16_t idx = codes.size();
+        airports.insert(code, idx);
+        codes.push_back(code);
+        src_counts.push_back(0);
+        return idx;
+    }
+
+    void parse(const std::string &file_name) {
+        flight_scanner_t scanner(file_name, begin, end);
+        raw_flight_t row;
+        while (scanner.read_row(row)) {
+            uint16_t src_idx = intern(row.src_code, file_name);
+            uint16_t dest_idx = intern(row.dest_code, file_name);
+
+            flight_t flight = {src_idx, dest_idx, row.day, row.price};
+            flights.push_back(flight);
+            src_counts[src_idx]++;
+
+            if (flights.size() == 1 || row.price < minimal_price) minimal_price = row.price;
+            if (row.day >= days_total) days_total = row.day + 1;
+        }
+        lines = scanner.get_file_line();
+    }
+
+    const char *begin, *end;
+    unsigned lines;
+    airport_index_t airports;
+    std::vector<nodename_t> codes;
+    std::vector<flight_t> flights;
+    std::vector<size_t> src_counts;  // Flights of each source, then where they go in its bucket
+    uint16_t days_total;
+    uint16_t minimal_price;
+    std::exception_ptr error;
+};
+
+// The CSV reader only goes forward, it can't be split
+bool read_flights_parallel(input_reader_t &, flight_buckets_t &, solver_threads_t &) {
+    return false;
+}
+
+// Splits what is left of an input in memory at line ends into a piece per
+// ingest thread, parses the pieces into flights of their own and merges them into
+// the buckets. The airports get their indices in the order of the pieces,
+// and the flights keep the input order, so the buckets end up as if read
+// line by line. False if the input is a stream or too small to bother.
+bool read_flights_parallel(flight_scanner_t &scanner, flight_buckets_t &buckets, solver_threads_t &threads) {
+    if (scanner.fd >= 0) return false;
+
+    const char *begin = scanner.pos;
+    const char *end = scanner.limit;
+    size_t pieces = std::min<size_t>(threads.ingest_threads, (end - begin) / INGEST_CHUNK_MIN_BYTES);
+    if (pieces < 2) return false;
+
+    std::vector<chunk_flights_t> chunks(pieces);
+    const char *piece_begin = begin;
+    for (size_t k = 0; k < pieces; ++k) {
+        const char *piece_end = end;
+        if (k + 1 < pieces) {
+            piece_end = std::max(begin + (end - begin) / pieces * (k + 1), piece_begin);
+            const char *newline = (const char *) memchr(piece_end, '\n', end - piece_end);
+            piece_end = newline != NULL ? newline + 1 : end;
+        }
+        chunks[k].begin = piece_begin;
+        chunks[k].end = piece_end;
+        piece_begin = piece_end;
+    }
+
+    worker_pool_t &pool = threads.ingest();
+    auto run = [&](std::function<void (chunk_flights_t &)> work) {
+        pool.run([&](unsigned int k) {
+            if (k >= pieces) return;
+            try {
+                work(chunks[k]);
+            } catch (...) {
+                chunks[k].error = std::current_exception();
+            }
+        });
+    };
+
+    run([&](chunk_flights_t &chunk) { chunk.parse(buckets.file_name); });
+
+    // The first error in the input is the one reported. Reading its piece
+    // again with the lines before counted throws it with the right line.
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        if (!it->error) continue;
+
+        unsigned first_line = scanner.get_file_line() + std::count(begin, it->begin, '\n');
+        flight_scanner_t again(buckets.file_name, it->begin, it->end, first_line);
+        raw_flight_t row;
+        while (again.read_row(row)) {}
+        std::rethrow_exception(it->error);
+    }
+
+    // Global airport indices, and where the flights of every piece start
+    // in the buckets of their sources
+    std::vector<std::vector<uint16_t> > global_idx(pieces);
+    std::vector<size_t> bucket_sizes;
+    for (size_t k = 0; k < pieces; ++k) {
+        chunk_flights_t &chunk = chunks[k];
+        if (chunk.flights.empty()) continue;
+
+        for (auto it = chunk.codes.cbegin(); it != chunk.codes.cend(); ++it) {
+            global_idx[k].push_back(buckets.intern(*it));
+        }
+        bucket_sizes.resize(buckets.nodes.size(), 0);
+        for (size_t idx = 0; idx < chunk.codes.size(); ++idx) {
+            size_t &size = bucket_sizes[global_idx[k][idx]];
+            size_t count = chunk.src_counts[idx];
+            chunk.src_counts[idx] = size;
+            size += count;
+        }
+
+        if (buckets.flight_count == 0 || chunk.minimal_price < buckets.minimal_price) {
+            buckets.minimal_price = chunk.minimal_price;
+        }
+        buckets.days_total = std::max(buckets.days_total, chunk.days_total);
+        buckets.flight_count += chunk.flights.size();
+    }
+    for (size_t idx = 0; idx < bucket_sizes.size(); ++idx) {
+        buckets.by_src[idx].resize(bucket_sizes[idx]);
+    }
+
+    // The pieces write to their own ranges of the buckets
+    run([&](chunk_flights_t &chunk) {
+        const std::vector<uint16_t> &to_global = global_idx[&chunk - &chunks[0]];
+        for (auto it = chunk.flights.cbegin(); it != chunk.flights.cend(); ++it) {
+            flight_t flight = {to_global[it->src_idx], to_global[it->dest_idx], it->day, it->price};
+            buckets.by_src[flight.src_idx][chunk.src_counts[it->src_idx]++] = flight;
+        }
+        std::vector<flight_t>().swap(chunk.flights);
+    });
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        if (it->error) std::rethrow_exception(it->error);
+    }
+
+    for (auto it = chunks.cbegin(); it != chunks.cend(); ++it) {
+        scanner.line += it->lines;
+    }
+    scanner.pos = end;
+    return true;
+}
+
+void build_graph(arena_t &arena, std::vector<node_t*> &nodes, flight_buckets_t &buckets);
+
+// The graph is sized by the airports and days found. Anything that
+// doesn't fit the index types throws input_error_t or an io::error. Large
+// inputs in memory are parsed in pieces by the ingest threads, otherwise
+// with pipelined the lines are parsed on another thread while this one
+// builds up the flight buckets. Pipelined with early_construction, the
+// early construction of threads is started and set into early.
+template <typename reader_t>
+uint16_t read_input(reader_t &reader, arena_t &arena, std::vector<node_t*> &nodes,
+                    node_t* &start, uint16_t &minimal_price, bool pipelined, bool early_construction,
+                    solver_threads_t &threads, early_construction_t * &early) {
+
+    char *start_code_raw = reader.next_line();
+    if (start_code_raw == NULL) throw input_error_t(reader, "no start airport");
+    if (strlen(start_code_raw) != 3) throw input_error_t(reader, "airport codes have 3 letters");
+    nodename_t start_code = {start_code_raw[0], start_code_raw[1], start_code_raw[2], 0};
+
+    flight_buckets_t buckets(reader.get_truncated_file_name(), arena, nodes);
+    if (threads.ingest_threads > 1 && read_flights_parallel(reader, buckets, threads)) {
+        // Parsed in pieces
+    } else if (pipelined) {
+        if (early_construction) {
+            early = &threads.early();
+            early->start();
+        }
+        read_flights_pipelined(reader, buckets, threads.parser(), early, start_code);
+        if (early != NULL) early->finish_reading();
+    } else {
+        raw_flight_t row;
+        while (read_flight(reader, row)) buckets.add(row);
+    }
+
+    uint16_t days_total = buckets.days_total;
+    minimal_price = buckets.minimal_price;
+
+    if (buckets.flight_count == 0) throw input_error_t(reader, "no flights");
+    if (buckets.flight_count > UINT32_MAX) throw input_error_t(reader, "too many flights");
+    uint16_t start_idx = buckets.airports.find(start_code);
+    if (start_idx == airport_index_t::ABSENT) throw input_error_t(reader, "no flights from the start airport");
+
+    build_graph(arena, nodes, buckets);
+
+    start = nodes[start_idx];
+
+    return days_total;
+}
+
+
+// Native byte order as the writer of a binary file saw it
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum output_format_t { TEXT_OUTPUT, JSON_OUTPUT, BINARY_OUTPUT };
+
+// --format binary: this header followed by one solution_leg_t per day
+struct solution_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // BYTE_ORDER_MARK
+    uint32_t price;  // Fits, at most 65535 days at 65535
+    uint32_t legs;
+};
+
+struct solution_leg_t {
+    nodename_t src, dest;
+    uint16_t day;
+    uint16_t price;
+};
+
+const char SOLUTION_MAGIC[8] = { 'K', 'I', 'W', 'I', 'S', 'O', 'L', 'N' };
+const uint32_t SOLUTION_VERSION = 1;
+
+// Longest escape of one character in a JSON string, \u001f
+const size_t MAX_JSON_ESCAPE_BYTES = 6;
+
+// Escapes c for a JSON string into out and returns the length
+size_t escape_json(char c, char * out) {
+    if (c == '"' || c == '\\') {
+        out[0] = '\\';
+        out[1] = c;
+        return 2;
+    }
+    if ((unsigned char) c < 0x20) {
+        const char *hex = "0123456789abcdef";
+        memcpy(out, "\\u00", 4);
+        out[4] = hex[c >> 4];
+        out[5] = hex[c & 0xf];
+        return MAX_JSON_ESCAPE_BYTES;
+    }
+    out[0] = c;
+    return 1;
+}
+
+void write_json_string(std::ostream &out, const char * text) {
+    char escaped[MAX_JSON_ESCAPE_BYTES];
+    out << '"';
+    for (; *text != '\0'; ++text) {
+        out.write(escaped, escape_json(*text, escaped));
+    }
+    out << '"';
+}
+
+// The solution formatted in one buffer, written out with one system call.
+// The buffer only grows, so a thread reusing it stops allocating once it
+// has seen its longest path.
+struct output_buffer_t {
+    // Longest formatting of one leg, JSON with 5 digit day and price and
+    // airport codes of nothing but escaped characters
+    static const size_t MAX_LEG_BYTES = 96;
+
+    output_buffer_t() : size(0) {};
+
+    void format(const std::vector<route_t *> &path, price_t total_price, output_format_t format) {
+        size_t needed = std::max(sizeof(solution_header_t), MAX_LEG_BYTES) + MAX_LEG_BYTES * path.size();
+        if (data.size() < needed) data.resize(needed);
+        size = 0;
+
+        if (format == BINARY_OUTPUT) {
+            format_binary(path, total_price);
+            return;
+        }
+
+        bool json = format == JSON_OUTPUT;
+        if (json) append("{\"price\": ");
+        append_number(total_price);
+        append(json ? ", \"flights\": [" : "\n");
+
+        uint32_t day = 0;
+        for (auto it = path.cbegin(); it != path.cend(); ++it, ++day) {
+            if (json) {
+                if (day > 0) append(", ");
+                append("{\"from\": \"");
+                append_json((*it)->src->name.data());
+                append("\", \"to\": \"");
+                append_json((*it)->dest->name.data());
+                append("\", \"day\": ");
+                append_number(day);
+                append(", \"price\": ");
+                append_number((*it)->price);
+                append("}");
+            } else {
+                append((*it)->src->name.data());
+                data[size++] = ' ';
+                append((*it)->dest->name.data());
+                data[size++] = ' ';
+                append_number(day);
+                data[size++] = ' ';
+                append_number((*it)->price);
+                data[size++] = '\n';
+            }
+        }
+
+        if (json) append("]}\n");
+    }
+
+    void format_binary(const std::vector<route_t *> &path, price_t total_price) {
+        solution_header_t header;
+        memcpy(header.magic, SOLUTION_MAGIC, sizeof(SOLUTION_MAGIC));
+        header.version = SOLUTION_VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.price = total_price;
+        header.legs = path.size();
+        memcpy(&data[size], &header, sizeof(header));
+        size += sizeof(header);
+
+        uint16_t day = 0;
+        for (auto it = path.cbegin(); it != path.cend(); ++it, ++day) {
+            solution_leg_t leg = { (*it)->src->name, (*it)->dest->name, day, (*it)->price };
+            memcpy(&data[size], &leg, sizeof(leg));
+            size += sizeof(leg);
+        }
+    }
+
+    // Airport codes have at most 3 letters
+    void append(const char * text) {
+        while (*text != '\0') data[size++] = *text++;
+    }
+
+    void append_json(const char * text) {
+        while (*text != '\0') size += escape_json(*text++, &data[size]);
+    }
+
+    void append_number(uint32_t value) {
+        char digits[10];
+        int count = 0;
+        do {
+            digits[count++] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        while (count > 0) data[size++] = digits[--count];
+    }
+
+    // Doesn't return before all is written, false on an error
+    bool write_to(int fd) const {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t done = write(fd, data.data() + written, size - written);
+            if (done < 0 && errno == EINTR) continue;
+            if (done < 0) return false;
+            written += done;
+        }
+        return true;
+    }
+
+    std::vector<char> data;
+    size_t size;
+};
+
+// Read-only mapping of a whole file, data is NULL if it couldn't be mapped.
+// A file that is open but can't be mapped (a pipe, a FIFO, an empty file)
+// stays open in fd to be read as a stream, otherwise error is the errno of
+// the failed open().
+struct mapped_file_t {
+    mapped_file_t(const char * file_name) : data(NULL), size(0), fd(-1), error(0) {
+        int file_fd = open(file_name, O_RDONLY);
+        if (file_fd < 0) {
+            error = errno;
+            return;
+        }
+
+        struct stat info;
+        if (fstat(file_fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = static_cast<const char *>(mapping);
+                size = info.st_size;
+            }
+        }
+        if (data != NULL) {
+            close(file_fd);
+        } else {
+            fd = file_fd;
+        }
+    }
+
+    ~mapped_file_t() {
+        if (data != NULL) munmap(const_cast<char *>(data), size);
+        if (fd >= 0) close(fd);
+    }
+
+    mapped_file_t(const mapped_file_t &) = delete;
+    mapped_file_t & operator = (const mapped_file_t &) = delete;
+
+    const char *data;
+    size_t size;
+    int fd;     // Open when not mapped
+    int error;  // Of open()
+};
+
+// Graph written by --compile: this header, the node names, day_offsets,
+// route_dests, route prices and the routes in price order as indices, each
+// array 8 byte aligned. day_offsets and route_dests are used straight from
+// the mapped file, the routes only need their pointers filled in. Written
+// in native byte order, GRAPH_VERSION changes with the layout.
+struct graph_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // BYTE_ORDER_MARK
+    uint32_t node_count;
+    uint32_t days_total;
+    uint32_t route_count;
+    uint16_t start_idx;
+    uint16_t minimal_price;
+};
+
+const char GRAPH_MAGIC[8] = { 'K', 'I', 'W', 'I', 'G', 'R', 'P', 'H' };
+const uint32_t GRAPH_VERSION = 1;
+
+// Offsets of the arrays in a compiled graph
+struct graph_layout_t {
+    graph_layout_t(const graph_header_t &header) {
+        size_t at = sizeof(graph_header_t);
+        names = at;
+        at = align(at + sizeof(nodename_t) * header.node_count);
+        day_offsets = at;
+        at = align(at + sizeof(uint32_t) * ((size_t) header.node_count * header.days_total + 1));
+        route_dests = at;
+        at = align(at + sizeof(uint16_t) * header.route_count);
+        prices = at;
+        at = align(at + sizeof(uint16_t) * header.route_count);
+        cheapest = at;
+        at = align(at + sizeof(uint32_t) * header.route_count);
+        total = at;
+    }
+
+    static size_t align(size_t offset) {
+        return (offset + 7) & ~(size_t) 7;
+    }
+
+    size_t names, day_offsets, route_dests, prices, cheapest, total;
+};
+
+bool is_compiled_graph(const char * data, size_t size) {
+    return size >= sizeof(GRAPH_MAGIC) && memcmp(data, GRAPH_MAGIC, sizeof(GRAPH_MAGIC)) == 0;
+}
+
+void write_section(std::ostream &out, const void * data, size_t bytes) {
+    static const char padding[8] = {};
+    out.write(static_cast<const char *>(data), bytes);
+    out.write(padding, graph_layout_t::align(bytes) - bytes);
+}
+
+bool write_graph(const char * file_name, const std::vector<node_t*> &nodes, node_t * start,
+                 uint16_t days_total, uint16_t minimal_price) {
+    const node_t *first = nodes.front();
+    uint32_t route_count = first->day_offsets[nodes.size() * days_total];
+
+    graph_header_t header;
+    memcpy(header.magic, GRAPH_MAGIC, sizeof(GRAPH_MAGIC));
+    header.version = GRAPH_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.node_count = nodes.size();
+    header.days_total = days_total;
+    header.route_count = route_count;
+    header.start_idx = start->idx;
+    header.minimal_price = minimal_price;
+
+    std::vector<nodename_t> names;
+    for (auto it = nodes.cbegin(); it != nodes.cend(); ++it) {
+        names.push_back((*it)->name);
+    }
+
+    std::vector<uint16_t> prices(route_count);
+    std::vector<uint32_t> cheapest(route_count);
+    for (uint32_t k = 0; k < route_count; ++k) {
+        prices[k] = first->routes[k].price;
+        cheapest[k] = first->cheapest_routes[k] - first->routes;
+    }
+
+    std::ofstream out(file_name, std::ios::binary);
+    write_section(out, &header, sizeof(header));
+    write_section(out, names.data(), sizeof(nodename_t) * names.size());
+    write_section(out, first->day_offsets, sizeof(uint32_t) * (nodes.size() * days_total + 1));
+    write_section(out, first->route_dests, sizeof(uint16_t) * route_count);
+    write_section(out, prices.data(), sizeof(uint16_t) * route_count);
+    write_section(out, cheapest.data(), sizeof(uint32_t) * route_count);
+    out.close();
+
+    return !out.fail();
+}
+
+// Sets up the nodes of a compiled graph, which has to stay mapped while
+// they are used. Every index and name terminator is checked, a damaged
+// file gives an error.
+// Only the day offsets and destinations are used in place. route_t holds
+// node pointers, so the routes and their price order are built here in
+// one O(routes) pass: no parsing, hashing or sorting, but far from free,
+// about half a second for 16M routes.
+uint16_t load_graph(const mapped_file_t &file, arena_t &arena, std::vector<node_t*> &nodes,
+                    node_t* &start, uint16_t &minimal_price) {
+    graph_header_t header;
+    if (file.size < sizeof(header)) throw std::runtime_error("truncated header");
+    memcpy(&header, file.data, sizeof(header));
+
+    if (header.version != GRAPH_VERSION || header.byte_order != BYTE_ORDER_MARK) {
+        throw std::runtime_error("compiled by an incompatible version, compile it again");
+    }
+    if (header.node_count == 0 || header.node_count > UINT16_MAX || header.days_total == 0 ||
+        header.days_total > UINT16_MAX || header.route_count == 0 || header.start_idx >= header.node_count) {
+        throw std::runtime_error("bad header");
+    }
+
+    graph_layout_t layout(header);
+    if (file.size < layout.total) throw std::runtime_error("truncated file");
+
+    const nodename_t *names = reinterpret_cast<const nodename_t *>(file.data + layout.names);
+    const uint32_t *day_offsets = reinterpret_cast<const uint32_t *>(file.data + layout.day_offsets);
+    const uint16_t *route_dests = reinterpret_cast<const uint16_t *>(file.data + layout.route_dests);
+    const uint16_t *prices = reinterpret_cast<const uint16_t *>(file.data + layout.prices);
+    const uint32_t *cheapest = reinterpret_cast<const uint32_t *>(file.data + layout.cheapest);
+
+    uint32_t node_count = header.node_count;
+    uint32_t days_total = header.days_total;
+    uint32_t route_count = header.route_count;
+    size_t buckets = (size_t) node_count * days_total;
+
+    if (day_offsets[0] != 0 || day_offsets[buckets] != route_count) throw std::runtime_error("bad day offsets");
+    for (size_t bucket = 0; bucket < buckets; ++bucket) {
+        if (day_offsets[bucket] > day_offsets[bucket + 1]) throw std::runtime_error("bad day offsets");
+    }
+
+    // Names are printed as C strings, a missing terminator would run past them
+    for (uint32_t idx = 0; idx < node_count; ++idx) {
+        if (names[idx][3] != '\0') throw std::runtime_error("bad airport name");
+    }
+
+    for (uint32_t idx = 0; idx < node_count; ++idx) {
+        nodes.push_back(arena.make<node_t>(names[idx], idx));
+    }
+
+    route_t *routes = arena.make_array<route_t>(route_count);
+    route_t **cheapest_routes = arena.make_array<route_t*>(route_count);
+
+    // get_route() searches the destinations of a bucket, and the cheapest
+    // routes of a bucket have to be its own routes in (price, index) order
+    for (size_t bucket = 0; bucket < buckets; ++bucket) {
+        node_t *src = nodes[bucket / days_total];
+        uint32_t first = day_offsets[bucket];
+        uint32_t last = day_offsets[bucket + 1];
+        for (uint32_t k = first; k < last; ++k) {
+            if (route_dests[k] >= node_count) throw std::runtime_error("bad route destination");
+            if (k > first && route_dests[k] <= route_dests[k - 1]) throw std::runtime_error("unsorted route destinations");
+            new (&routes[k]) route_t(src, nodes[route_dests[k]], prices[k]);
+        }
+        for (uint32_t k = first; k < last; ++k) {
+            uint32_t route = cheapest[k];
+            if (route < first || route >= last) throw std::runtime_error("bad route order");
+            if (k > first) {
+                uint32_t previous = cheapest[k - 1];
+                if (prices[route] < prices[previous] || (prices[route] == prices[previous] && route <= previous)) {
+                    throw std::runtime_error("bad route order");
+                }
+            }
+            cheapest_routes[k] = &routes[route];
+        }
+    }
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+        (*it)->day_offsets = day_offsets + (size_t) (*it)->idx * days_total;
+        (*it)->route_dests = route_dests;
+        (*it)->routes = routes;
+        (*it)->cheapest_routes = cheapest_routes;
+    }
+
+    start = nodes[header.start_idx];
+    minimal_price = header.minimal_price;
+    return days_total;
+}
+
+bool depth_search(node_t * start, uint16_t days_total, size_t node_count,
+                  std::vector<route_t*> &path, price_t &total_price,
+                  deadline_t deadline) {
+
+    // Everything is allocated up front, one frame per day
+    node_set_t visited_nodes(node_count);
+    std::vector<dfs_frame_t> frames(days_total);
+    path.reserve(days_total);
+
+    uint16_t day = 0;
+    visited_nodes.insert(start->idx);
+    frames[0].next = start->cheapest_routes_begin(0);
+    frames[0].end = start->cheapest_routes_end(0);
+
+    bool timed_out = false;
+
+    while (true) {
+        if (deadline.expired()) {
+            timed_out = true;
+            break;
+        }
+
+        dfs_frame_t &frame = frames[day];
+        while (frame.next != frame.end &&
+                (day == days_total - 1 ? (*frame.next)->dest != start
+                                       : visited_nodes.contains((*frame.next)->dest->idx))) {
+            ++frame.next;
+        }
+
+        if (frame.next == frame.end) {
+            if (day == 0) break;
+
+            // All routes of this day tried, step back
+            day--;
+            total_price -= path.back()->price;
+            visited_nodes.erase(path.back()->dest->idx);
+            path.pop_back();
+            continue;
+        }
+
+        route_t *this_route = *frame.next++;
+        path.push_back(this_route);
+        total_price += this_route->price;
+        day++;
+
+        if (day == days_total) break;
+
+        node_t *this_node = this_route->dest;
+        visited_nodes.insert(this_node->idx);
+        frames[day].next = this_node->cheapest_routes_begin(day);
+        frames[day].end = this_node->cheapest_routes_end(day);
+    }
+
+    if (day != days_total) {
+        if (timed_out) {
+            std::cerr << "Out of time, no circle" << std::endl;
+        } else {
+            std::cerr << "Stack depleted, no circle" << std::endl;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
+// Best moves found in a slice of the neighbourhood. Candidates are offered
+// in (i, j) order and only a strictly better one replaces the current pick,
+// so ties always go to the first evaluated move.
+struct neighbour_selection_t {
+    neighbour_selection_t() : penalized_price(0),
+        priced(0), missing_route(0), tabu_rejected(0), aspiration(0) {};
+
+    void offer(const neighbour_t &neighbour, price_t neighbour_penalized_price) {
+        if (best.i == 0 || best.price > neighbour.price) {
+            best = neighbour;
+        }
+        if (penalized.i == 0 || penalized_price > neighbour_penalized_price) {
+            penalized = neighbour;
+            penalized_price = neighbour_penalized_price;
+        }
+    }
+
+    void merge(const neighbour_selection_t &other) {
+        if (other.best.i != 0 && (best.i == 0 || best.price > other.best.price)) {
+            best = other.best;
+        }
+        if (other.penalized.i != 0) {
+            if (penalized.i == 0 || penalized_price > other.penalized_price) {
+                penalized = other.penalized;
+                penalized_price = other.penalized_price;
+            }
+        }
+    }
+
+    neighbour_t best;
+    neighbour_t penalized;
+    price_t penalized_price;
+
+    // Counted for search_stats_t, cheap enough to do always
+    uint64_t priced, missing_route, tabu_rejected, aspiration;
+};
+
+// Counters and improvement trace of the tabu search, written by --telemetry.
+// The hot loop counts into its neighbour_selection_t and the totals are
+// added here once per iteration.
+struct search_stats_t {
+    struct improvement_t {
+        double ms;  // Since the start of the instance
+        uint64_t iteration;
+        price_t price;
+
+        bool operator < (const improvement_t &other) const {
+            return ms < other.ms;
+        }
+    };
+
+    search_stats_t(std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now())
+        : started(started), iterations(0), moves_priced(0), missing_route(0),
+        tabu_rejected(0), aspiration(0), penalized_picks(0), kicks(0), restarts(0) {};
+
+    void count(const neighbour_selection_t &selection) {
+        moves_priced += selection.priced;
+        missing_route += selection.missing_route;
+        tabu_rejected += selection.tabu_rejected;
+        aspiration += selection.aspiration;
+    }
+
+    void record(uint64_t iteration, price_t price) {
+        improvement_t improvement = {
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count(),
+            iteration, price
+        };
+        trace.push_back(improvement);
+    }
+
+    // Traces are kept in time order
+    void add(const search_stats_t &other) {
+        iterations += other.iterations;
+        moves_priced += other.moves_priced;
+        missing_route += other.missing_route;
+        tabu_rejected += other.tabu_rejected;
+        aspiration += other.aspiration;
+        penalized_picks += other.penalized_picks;
+        kicks += other.kicks;
+        restarts += other.restarts;
+
+        size_t middle = trace.size();
+        trace.insert(trace.end(), other.trace.begin(), other.trace.end());
+        std::inplace_merge(trace.begin(), trace.begin() + middle, trace.end());
+    }
+
+    // Batch mode names the instance in the first field
+    void write(std::ostream &out, const char * input = NULL) const {
+        out << "{";
+        if (input != NULL) {
+            out << "\"input\": ";
+            write_json_string(out, input);
+            out << ", ";
+        }
+        out << "\"iterations\": " << iterations
+            << ", \"moves_priced\": " << moves_priced
+            << ", \"missing_route\": " << missing_route
+            << ", \"tabu_rejected\": " << tabu_rejected
+            << ", \"aspiration\": " << aspiration
+            << ", \"penalized_picks\": " << penalized_picks
+            << ", \"kicks\": " << kicks
+            << ", \"restarts\": " << restarts
+            << ", \"improvements\": [";
+        for (auto it = trace.cbegin(); it != trace.cend(); ++it) {
+            if (it != trace.cbegin()) out << ", ";
+            out << "{\"ms\": " << it->ms << ", \"iteration\": " << it->iteration
+                << ", \"price\": " << it->price << "}";
+        }
+        out << "]}" << std::endl;
+    }
+
+    std::chrono::steady_clock::time_point started;
+    uint64_t iterations;
+    uint64_t moves_priced;     // Swaps priced again in the cache and segment moves
+    uint64_t missing_route;    // Priced moves needing a route that doesn't exist
+    uint64_t tabu_rejected;    // Feasible tabu moves left out
+    uint64_t aspiration;       // Tabu moves taken anyway as they beat the best price
+    uint64_t penalized_picks;  // Iterations that fell back to the frequency-penalized swap
+    uint64_t kicks;
+    uint64_t restarts;         // Kicks that started from an elite solution
+    std::vector<improvement_t> trace;
+};
+
+// Exact search through all paths. Routes are tried cheapest first and a
+// branch is cut as soon as its price plus a lower bound of the remaining
+// legs reaches the incumbent. The bound is the larger of
+//  - the cheapest route of every remaining day
+//  - the cheapest way to enter every unvisited city (and the start on the
+//    last day) on one of the remaining days
+struct branch_and_bound_t {
+    static const price_t NO_ROUTE = INT64_MAX / 4;
+
+    branch_and_bound_t(const std::vector<node_t*> &nodes, node_t * start, uint16_t days_total,
+                       deadline_t deadline)
+        : nodes(nodes), start(start), days_total(days_total), deadline(deadline),
+          visited(nodes.size()),
+          day_bound(days_total + 1, 0),
+          enter_bound(nodes.size() * (days_total + 1), NO_ROUTE),
+          timed_out(false), best_path(NULL), best_price(0) {
+
+        std::vector<price_t> day_min(days_total, NO_ROUTE);
+
+        for (auto it = nodes.cbegin(); it != nodes.cend(); ++it) {
+            for (uint16_t day = 0; day < days_total; ++day) {
+                for (route_t *route = (*it)->routes_begin(day); route != (*it)->routes_end(day); ++route) {
+                    day_min[day] = std::min<price_t>(day_min[day], route->price);
+
+                    // Only the start is entered on the last day
+                    if ((day == days_total - 1) != (route->dest == start)) continue;
+                    price_t &enter = enter_bound[route->dest->idx * (days_total + 1) + day];
+                    enter = std::min<price_t>(enter, route->price);
+                }
+            }
+        }
+
+        for (int day = days_total - 1; day >= 0; --day) {
+            day_bound[day] = std::min(NO_ROUTE, day_bound[day + 1] + day_min[day]);
+            for (size_t idx = 0; idx < nodes.size(); ++idx) {
+                price_t &enter = enter_bound[idx * (days_total + 1) + day];
+                enter = std::min(enter, enter_bound[idx * (days_total + 1) + day + 1]);
+            }
+        }
+    }
+
+    // Improves the given path if possible. Returns true when the whole
+    // search space was explored, i.e. the resulting path is optimal.
+    bool solve(std::vector<route_t*> &path, price_t &total_price) {
+        best_path = &path;
+        best_price = total_price;
+        current_path.clear();
+        visited.insert(start->idx);
+
+        expand(start, 0, 0);
+
+        total_price = best_price;
+        return !timed_out;
+    }
+
+    // Lower bound of the legs from given day on, with the current visited set.
+    // The path enters days_total - day - 1 more airports besides the start,
+    // all of them when there are as many airports as days, otherwise the
+    // cheapest entries of the unvisited ones are what it costs at least.
+    price_t lower_bound(uint16_t day) {
+        if (day == days_total) return 0;
+
+        price_t enter = enter_bound[start->idx * (days_total + 1) + days_total - 1];
+        if (nodes.size() == days_total) {
+            for (size_t idx = 0; idx < nodes.size() && enter < NO_ROUTE; ++idx) {
+                if (visited.contains(idx)) continue;
+                enter += enter_bound[idx * (days_total + 1) + day];
+            }
+        } else {
+            size_t entered = days_total - day - 1;
+            unvisited_enter.clear();
+            for (size_t idx = 0; idx < nodes.size(); ++idx) {
+                if (!visited.contains(idx)) unvisited_enter.push_back(enter_bound[idx * (days_total + 1) + day]);
+            }
+            if (unvisited_enter.size() < entered) return NO_ROUTE;
+            std::nth_element(unvisited_enter.begin(), unvisited_enter.begin() + entered, unvisited_enter.end());
+            for (size_t k = 0; k < entered && enter < NO_ROUTE; ++k) {
+                enter += unvisited_enter[k];
+            }
+        }
+
+        return std::max(std::min(enter, NO_ROUTE), day_bound[day]);
+    }
+
+    void expand(node_t * node, uint16_t day, price_t price) {
+        if (day == days_total) {
+            if (price < best_price) {
+                best_price = price;
+                *best_path = current_path;
+            }
+            return;
+        }
+
+        if (deadline.expired()) {
+            timed_out = true;
+            return;
+        }
+
+        route_t * const *end = node->cheapest_routes_end(day);
+        for (route_t * const *it = node->cheapest_routes_begin(day); it != end && !timed_out; ++it) {
+            node_t *dest = (*it)->dest;
+            if (day == days_total - 1 ? dest != start : visited.contains(dest->idx)) continue;
+
+            price_t next_price = price + (*it)->price;
+
+            // Routes are sorted, none of the following ones can do better
+            if (next_price + day_bound[day + 1] >= best_price) break;
+
+            if (dest == start) {
+                current_path.push_back(*it);
+                expand(dest, day + 1, next_price);
+                current_path.pop_back();
+                continue;
+            }
+
+            visited.insert(dest->idx);
+            if (next_price + lower_bound(day + 1) < best_price) {
+                current_path.push_back(*it);
+                expand(dest, day + 1, next_price);
+                current_path.pop_back();
+            }
+            visited.erase(dest->idx);
+        }
+    }
+
+    const std::vector<node_t*> &nodes;
+    node_t *start;
+    uint16_t days_total;
+    deadline_t deadline;
+
+    node_set_t visited;
+    std::vector<route_t*> current_path;
+    std::vector<price_t> unvisited_enter;  // Scratch of lower_bound()
+
+    std::vector<price_t> day_bound;    // Sum of the cheapest routes of days >= d
+    std::vector<price_t> enter_bound;  // [idx * (days_total + 1) + d], cheapest entry on days >= d
+
+    bool timed_out;
+    std::vector<route_t*> *best_path;
+    price_t best_price;
+};
+
+// Price change of a swap with a missing route. A swap changes at most four
+// legs, so real changes are far from it.
+const int32_t NO_SWAP = INT32_MAX;
+
+// Price change of swapping cities at i and j, NO_SWAP if a route is missing
+int32_t swap_delta(uint16_t i, uint16_t j, const std::vector<route_t*> &path) {
+    int32_t delta = 0;
+
+    route_t* old_i_left = path[i - 1];
+    route_t* old_i_right = path[i];
+
+    route_t* old_j_left = path[j - 1];
+    route_t* old_j_right = path[j];
+
+    node_t* node_i = path[i]->src;
+    node_t* node_j = path[j]->src;
+
+    route_t* new_i_left = old_j_left->src->get_route(j-1, node_i->idx);
+    route_t* new_i_right = node_i->get_route(j, old_j_right->dest->idx);
+
+    route_t* new_j_left = old_i_left->src->get_route(i-1, node_j->idx);
+    route_t* new_j_right = node_j->get_route(i, old_i_right->dest->idx);
+
+    if (new_i_left == NULL || new_i_right == NULL || new_j_left == NULL || new_j_right == NULL) {
+        return NO_SWAP;
+    }
+
+    delta -= (old_i_right->price + old_j_left->price + old_j_right->price);
+    if (i - j > 1) delta -= old_i_left->price;
+
+    delta += (new_i_right->price + new_j_left->price + new_j_right->price);
+    if (i - j > 1) delta += new_i_left->price;
+
+    return delta;
+}
+
+// Current path as offsets into price_table_t, so that the prices of all
+// swaps (i, j) for a fixed i are four gathers per j
+struct dense_path_t {
+    void assign(const std::vector<route_t*> &path, const price_table_t &table) {
+        size_t days_total = path.size();
+        city.resize(days_total + 1);
+        city_row.resize(days_total + 1);
+        leg.resize(days_total);
+        i_left_base.resize(days_total);
+        i_right_base.resize(days_total);
+
+        for (size_t k = 0; k < days_total; ++k) {
+            city[k] = path[k]->src->idx;
+            city_row[k] = city[k] * table.node_count;
+            leg[k] = path[k]->price;
+        }
+        city[days_total] = path.back()->dest->idx;
+        city_row[days_total] = city[days_total] * table.node_count;
+
+        for (size_t j = 1; j < days_total; ++j) {
+            i_left_base[j] = table.offset(j - 1, city[j - 1], 0);
+            i_right_base[j] = table.offset(j, 0, city[j + 1]);
+        }
+    }
+
+    std::vector<int32_t> city;          // City visited on day k
+    std::vector<int32_t> city_row;      // city[k] * node_count
+    std::vector<int32_t> leg;           // Price paid on day k
+    std::vector<int32_t> i_left_base;   // Route (j - 1, city[j - 1], *)
+    std::vector<int32_t> i_right_base;  // Route (j, *, city[j + 1])
+};
+
+// Fills row[j] for 1 <= j < j_end with the price change of swapping i and
+// j, or NO_SWAP when a route is missing. Adjacent j = i - 1 is not handled
+// here.
+struct dense_row_t {
+    const int32_t *prices;
+    const dense_path_t *path;
+    int32_t i_left, i_right;  // city[i], city_row[i]
+    int32_t j_left, j_right;  // Routes (i - 1, city[i - 1], *) and (i, *, city[i + 1])
+    int32_t removed;          // leg[i - 1] + leg[i]
+
+    dense_row_t(const price_table_t &table, const dense_path_t &path, uint16_t i)
+        : prices(table.prices.data()), path(&path),
+          i_left(path.city[i]), i_right(path.city_row[i]),
+          j_left(table.offset(i - 1, path.city[i - 1], 0)),
+          j_right(table.offset(i, 0, path.city[i + 1])),
+          removed(path.leg[i - 1] + path.leg[i]) {};
+
+    int32_t delta(uint16_t j) const {
+        int32_t added = prices[path->i_left_base[j] + i_left]
+                      + prices[path->i_right_base[j] + i_right]
+                      + prices[j_left + path->city[j]]
+                      + prices[j_right + path->city_row[j]];
+        if (added >= price_table_t::MISSING) return NO_SWAP;
+        return added - removed - path->leg[j - 1] - path->leg[j];
+    }
+
+    void fill(uint16_t j_end, int32_t *row) const {
+        for (uint16_t j = 1; j < j_end; ++j) row[j] = delta(j);
+    }
+
+#ifdef KIWI_X86
+    __attribute__((target("avx2")))
+    void fill_avx2(uint16_t j_end, int32_t *row) const {
+        const __m256i missing = _mm256_set1_epi32(price_table_t::MISSING - 1);
+        const __m256i no_swap = _mm256_set1_epi32(NO_SWAP);
+        const __m256i removed_i = _mm256_set1_epi32(removed);
+        const __m256i i_left_v = _mm256_set1_epi32(i_left);
+        const __m256i i_right_v = _mm256_set1_epi32(i_right);
+        const __m256i j_left_v = _mm256_set1_epi32(j_left);
+        const __m256i j_right_v = _mm256_set1_epi32(j_right);
+
+        uint16_t j = 1;
+        for (; j + 8 <= j_end; j += 8) {
+            __m256i i_left_idx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &path->i_left_base[j]), i_left_v);
+            __m256i i_right_idx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &path->i_right_base[j]), i_right_v);
+            __m256i j_left_idx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &path->city[j]), j_left_v);
+            __m256i j_right_idx = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &path->city_row[j]), j_right_v);
+
+            __m256i added = _mm256_add_epi32(
+                _mm256_add_epi32(_mm256_i32gather_epi32(prices, i_left_idx, 4),
+                                 _mm256_i32gather_epi32(prices, i_right_idx, 4)),
+                _mm256_add_epi32(_mm256_i32gather_epi32(prices, j_left_idx, 4),
+                                 _mm256_i32gather_epi32(prices, j_right_idx, 4)));
+
+            __m256i removed_j = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &path->leg[j - 1]),
+                                                 _mm256_loadu_si256((const __m256i *) &path->leg[j]));
+            __m256i delta = _mm256_sub_epi32(_mm256_sub_epi32(added, removed_i), removed_j);
+            __m256i is_missing = _mm256_cmpgt_epi32(added, missing);
+
+            _mm256_storeu_si256((__m256i *) &row[j], _mm256_blendv_epi8(delta, no_swap, is_missing));
+        }
+        for (; j < j_end; ++j) row[j] = delta(j);
+    }
+#else
+    // Not taken, use_avx2 is always false here
+    void fill_avx2(uint16_t j_end, int32_t *row) const {
+        fill(j_end, row);
+    }
+#endif
+};
+
+// Segment moves cost O(days^2) per iteration, the cached swaps about
+// O(days). On long horizons the segment moves are only evaluated every
+// `period` iterations, right after a new best price (descents are short,
+// they get the whole neighbourhood) and whenever no swap is admissible.
+struct segment_schedule_t {
+    segment_schedule_t(int period) : period(period), until_due(0) {};
+
+    bool due() const {
+        return until_due == 0;
+    }
+
+    void evaluated() {
+        until_due = period;
+    }
+
+    void skipped() {
+        until_due--;
+    }
+
+    void touch(const neighbour_t &move, price_t best_price) {
+        if (move.price < best_price) until_due = 0;
+    }
+
+    int period;
+    int until_due;
+};
+
+// Best swap of a cache row by some value, j = 0 when the row has none.
+// Ties go to the lower j, like in a scan in (i, j) order.
+struct swap_pick_t {
+    swap_pick_t() : value(0), j(0) {};
+
+    void offer(price_t candidate_value, uint16_t candidate_j) {
+        if (j == 0 || value > candidate_value || (value == candidate_value && j > candidate_j)) {
+            value = candidate_value;
+            j = candidate_j;
+        }
+    }
+
+    price_t value;
+    uint16_t j;
+};
+
+// Picks of a cache row by price change: the best swap that isn't tabu, the
+// best one by frequency-penalized price change and the best tabu one, which
+// can only be taken through aspiration
+struct swap_row_picks_t {
+    bool tracks(uint16_t j) const {
+        return j == free.j || j == penalized.j || j == tabu.j;
+    }
+
+    swap_pick_t free;
+    swap_pick_t penalized;
+    swap_pick_t tabu;
+};
+
+// Price changes of all swaps (i, j) of the current path, kept between
+// iterations. A move only changes the swaps with a city in or next to the
+// cities it rearranged, so after the first fill only those rows and columns
+// are priced again. Feasible swaps are marked in a bitset per row, positions
+// that have no feasible swap at all are skipped without looking at them.
+// Every row also keeps its picks, so the selection only goes through rows.
+//
+// Pricing the touched rows and columns costs O(days) per iteration, in
+// random reads of the price table. With `candidates` set, every refill only
+// keeps that many partners of each row, the ones with the best price
+// change. Until the next refill a position next to a move only prices the
+// swaps on these lists, O(candidates), and a position whose city the move
+// changed prices its row and column in full and keeps that many of each.
+// A swap changes two cities, so that's about a third of the pricing. The
+// lists are refilled after `days` iterations, after a new best price and
+// when none of their swaps is admissible any more.
+struct swap_cache_t {
+    swap_cache_t(uint16_t days_total, uint16_t candidates = 0)
+        : days_total(days_total), words((days_total + 63) / 64), filled(false),
+          delta(days_total > 2 ? index(days_total, 0) : 0), feasible(days_total * words, 0), is_dirty(days_total, 0),
+          picks(days_total), is_stale(days_total, 0), ranked_iteration(0), ranked_epoch(0),
+          candidates(candidates), until_refill(0), dropped(false),
+          tracked(candidates > 0 ? days_total * words : 0, 0), is_moved(days_total, 0) {};
+
+    // Row i holds j = 1 .. i - 1
+    static size_t index(uint16_t i, uint16_t j) {
+        return (size_t) (i - 1) * (i - 2) / 2 + j - 1;
+    }
+
+    void set(uint16_t i, uint16_t j, int32_t change) {
+        uint64_t bit = (uint64_t) 1 << (j % 64);
+        if (change == NO_SWAP) {
+            feasible[i * words + j / 64] &= ~bit;
+        } else {
+            feasible[i * words + j / 64] |= bit;
+            delta[index(i, j)] = change;
+        }
+    }
+
+    // Cities at first .. last were rearranged
+    void touch(uint16_t first, uint16_t last) {
+        for (int k = std::max((int) first, 1); candidates > 0 && k <= std::min((int) last, days_total - 2); ++k) {
+            if (!is_moved[k]) moved.push_back(k);
+            is_moved[k] = 1;
+        }
+        for (int k = std::max(first - 1, 1); k <= std::min(last + 1, days_total - 2); ++k) {
+            if (!is_dirty[k]) dirty.push_back(k);
+            is_dirty[k] = 1;
+        }
+    }
+
+    void touch(const neighbour_t &move) {
+        if (move.type == SWAP) {
+            touch(move.j, move.j);
+            touch(move.i, move.i);
+        } else {
+            touch(move.key_j(), move.type == RELOCATE ? move.key_i() + move.length - 1 : move.i);
+        }
+    }
+
+    // Descents are short, they get every swap
+    void touch(const neighbour_t &move, price_t best_price) {
+        touch(move);
+        if (candidates > 0 && move.price < best_price) filled = false;
+    }
+
+    // Keeps the best partners of every priced row, the other swaps aren't
+    // priced again until the next refill
+    void restrict_to_candidates() {
+        until_refill = days_total;
+        dropped = false;
+        best.resize(candidates);
+
+        for (uint16_t i = 2; i < days_total - 1; ++i) keep_best_partners(i);
+    }
+
+    // Chooses the lists of a position whose city changed again once its row
+    // and column are priced in full, the swaps that were on them say nothing
+    // about the city now there
+    void choose_candidates(uint16_t p) {
+        keep_best_partners(p);
+
+        uint16_t count = 0;
+        uint64_t bit = (uint64_t) 1 << (p % 64);
+        for (uint16_t i = p + 1; i < days_total - 1; ++i) {
+            tracked[i * words + p / 64] &= ~bit;
+            if (!is_feasible(i, p)) continue;
+            feasible[i * words + p / 64] &= ~bit;
+            keep_best(count, i, delta[index(i, p)], [&](uint16_t row) { return delta[index(row, p)]; });
+        }
+        for (uint16_t k = 0; k < count; ++k) {
+            feasible[best[k] * words + p / 64] |= bit;
+            tracked[best[k] * words + p / 64] |= bit;
+        }
+    }
+
+    // Keeps the best feasible swaps of row i, sorted by price change, ties go
+    // to the lower j
+    void keep_best_partners(uint16_t i) {
+        uint16_t count = 0;
+        uint64_t *bits = &feasible[i * words];
+        for (uint16_t word = 0; word < words; ++word) {
+            for (uint64_t rest = bits[word]; rest != 0; rest &= rest - 1) {
+                uint16_t j = word * 64 + __builtin_ctzll(rest);
+                keep_best(count, j, delta[index(i, j)], [&](uint16_t partner) { return delta[index(i, partner)]; });
+            }
+            bits[word] = 0;
+        }
+        for (uint16_t k = 0; k < count; ++k) {
+            bits[best[k] / 64] |= (uint64_t) 1 << (best[k] % 64);
+        }
+        std::copy(bits, bits + words, &tracked[i * words]);
+    }
+
+    // Inserts `position` into the first `count` of best, which are sorted by
+    // the price change `change_of` gives them
+    template <typename change_of_t>
+    void keep_best(uint16_t &count, uint16_t position, int32_t change, change_of_t change_of) {
+        if (count == candidates) {
+            dropped = true;
+            if (change_of(best[count - 1]) <= change) return;
+        }
+
+        uint16_t k = count < candidates ? count++ : count - 1;
+        for (; k > 0 && change_of(best[k - 1]) > change; --k) best[k] = best[k - 1];
+        best[k] = position;
+    }
+
+    bool is_tracked(uint16_t i, uint16_t j) const {
+        return (tracked[i * words + j / 64] >> (j % 64)) & 1;
+    }
+
+    void clear_moved() {
+        for (auto it = moved.cbegin(); it != moved.cend(); ++it) {
+            is_moved[*it] = 0;
+        }
+        moved.clear();
+    }
+
+    void clear_dirty() {
+        for (auto it = dirty.cbegin(); it != dirty.cend(); ++it) {
+            is_dirty[*it] = 0;
+        }
+        dirty.clear();
+    }
+
+    bool is_feasible(uint16_t i, uint16_t j) const {
+        return (feasible[i * words + j / 64] >> (j % 64)) & 1;
+    }
+
+    void mark_stale(uint16_t i) {
+        if (!is_stale[i]) stale.push_back(i);
+        is_stale[i] = 1;
+    }
+
+    uint16_t days_total;
+    uint16_t words;  // Per row of the bitset
+    bool filled;
+    std::vector<int32_t> delta;
+    std::vector<uint64_t> feasible;
+    std::vector<uint16_t> dirty;     // Positions to price again
+    std::vector<uint8_t> is_dirty;
+    std::vector<swap_row_picks_t> picks;
+    std::vector<uint16_t> stale;     // Rows to find the picks of again
+    std::vector<uint8_t> is_stale;
+    uint64_t ranked_iteration;       // Of the tabu memory the picks are up to date with
+    uint64_t ranked_epoch;
+
+    uint16_t candidates;             // Partners kept per row, 0 keeps all
+    int until_refill;
+    bool dropped;                    // Some row had more feasible swaps
+    std::vector<uint64_t> tracked;   // Swaps priced again when touched, a superset of feasible
+    std::vector<uint16_t> moved;     // Positions whose city changed, their lists are chosen again
+    std::vector<uint8_t> is_moved;
+    std::vector<uint16_t> best;      // Scratch of keep_best()
+};
+
+// Prices rows i_begin .. i_end - 1 of the swap neighbourhood into the cache
+void price_swap_rows(uint16_t i_begin, uint16_t i_end,
+                     const std::vector<route_t*> &path,
+                     const price_table_t * prices, const dense_path_t * dense_path,
+                     swap_cache_t &cache,
+                     neighbour_selection_t &selection) {
+
+    static thread_local std::vector<int32_t> row;
+    if (prices != NULL) row.resize(path.size());
+
+    for (uint16_t i = i_begin; i < i_end; ++i) {
+        selection.priced += i - 1;
+
+        if (prices != NULL) {
+            dense_row_t dense_row(*prices, *dense_path, i);
+            if (prices->use_avx2) {
+                dense_row.fill_avx2(i - 1, row.data());
+            } else {
+                dense_row.fill(i - 1, row.data());
+            }
+        }
+
+        for (uint16_t j = 1; j < i; ++j) {
+            int32_t delta;
+            if (prices != NULL && j < i - 1) {
+                delta = row[j];
+            } else {
+                delta = swap_delta(i, j, path);
+            }
+
+            if (delta == NO_SWAP) selection.missing_route++;
+            cache.set(i, j, delta);
+        }
+    }
+}
+
+// Prices the swap (i, j) into the cache
+inline void price_swap(uint16_t i, uint16_t j,
+                       const std::vector<route_t*> &path,
+                       const price_table_t * prices, const dense_path_t * dense_path,
+                       swap_cache_t &cache,
+                       neighbour_selection_t &selection) {
+    int32_t delta;
+    if (prices != NULL && j < i - 1) {
+        delta = dense_row_t(*prices, *dense_path, i).delta(j);
+    } else {
+        delta = swap_delta(i, j, path);
+    }
+
+    selection.priced++;
+    if (delta == NO_SWAP) selection.missing_route++;
+    cache.set(i, j, delta);
+}
+
+// Prices the swaps (i, j) with i > j into the cache
+void price_swap_column(uint16_t days_total, uint16_t j,
+                       const std::vector<route_t*> &path,
+                       const price_table_t * prices, const dense_path_t * dense_path,
+                       swap_cache_t &cache,
+                       neighbour_selection_t &selection) {
+
+    for (uint16_t i = j + 1; i < days_total - 1; ++i) {
+        price_swap(i, j, path, prices, dense_path, cache, selection);
+    }
+}
+
+// Prices the swaps on the candidate lists that have a city at k
+void price_swap_candidates(uint16_t k,
+                           const std::vector<route_t*> &path,
+                           const price_table_t * prices, const dense_path_t * dense_path,
+                           swap_cache_t &cache,
+                           neighbour_selection_t &selection) {
+
+    const uint64_t *row = &cache.tracked[k * cache.words];
+    for (uint16_t word = 0; word < cache.words; ++word) {
+        for (uint64_t bits = row[word]; bits != 0; bits &= bits - 1) {
+            price_swap(k, word * 64 + __builtin_ctzll(bits), path, prices, dense_path, cache, selection);
+        }
+    }
+    for (uint16_t i = k + 1; i < cache.days_total - 1; ++i) {
+        if (cache.is_tracked(i, k)) price_swap(i, k, path, prices, dense_path, cache, selection);
+    }
+}
+
+inline void rank_swap(uint16_t i, uint16_t j, int32_t delta,
+                      const tabu_memory_t &memory, uint16_t minimal_price,
+                      swap_row_picks_t &picks) {
+    if (memory.applies(SWAP, i, j)) {
+        picks.tabu.offer(delta, j);
+        return;
+    }
+
+    picks.free.offer(delta, j);
+    picks.penalized.offer(delta + (price_t) minimal_price * memory.frequency(SWAP, i, j), j);
+}
+
+// Finds the picks of rows i_begin .. i_end - 1 from the feasible swaps
+void rank_swap_rows(uint16_t i_begin, uint16_t i_end,
+                    const tabu_memory_t &memory,
+                    uint16_t minimal_price,
+                    swap_cache_t &cache) {
+
+    for (uint16_t i = i_begin; i < i_end; ++i) {
+        swap_row_picks_t &picks = cache.picks[i];
+        picks = swap_row_picks_t();
+
+        const uint64_t *row = &cache.feasible[i * cache.words];
+        for (uint16_t word = 0; word < cache.words; ++word) {
+            for (uint64_t bits = row[word]; bits != 0; bits &= bits - 1) {
+                uint16_t j = word * 64 + __builtin_ctzll(bits);
+                rank_swap(i, j, cache.delta[swap_cache_t::index(i, j)], memory, minimal_price, picks);
+            }
+        }
+    }
+}
+
+// Brings the picks up to date once the dirty rows and columns are priced
+// again. Rows are ranked again when they're dirty, when the last recorded
+// move or the one whose tabu status just ended is theirs and when one of
+// their picks changed, it might have gotten worse. The other swaps of the
+// dirty columns are only offered to their rows.
+void update_swap_picks(const tabu_memory_t &memory,
+                       uint16_t minimal_price,
+                       swap_cache_t &cache) {
+
+    if (memory.iteration != cache.ranked_iteration) {
+        if (memory.last().type == SWAP) cache.mark_stale(memory.last().key_i());
+
+        const neighbour_t * expired = memory.expired();
+        if (expired != NULL && expired->type == SWAP) cache.mark_stale(expired->key_i());
+    }
+
+    for (auto it = cache.dirty.cbegin(); it != cache.dirty.cend(); ++it) {
+        cache.mark_stale(*it);
+    }
+
+    for (auto it = cache.dirty.cbegin(); it != cache.dirty.cend(); ++it) {
+        uint16_t j = *it;
+        for (uint16_t i = j + 1; i < cache.days_total - 1; ++i) {
+            if (cache.is_stale[i]) continue;
+
+            if (cache.picks[i].tracks(j)) {
+                cache.mark_stale(i);
+            } else if (cache.is_feasible(i, j)) {
+                rank_swap(i, j, cache.delta[swap_cache_t::index(i, j)], memory, minimal_price, cache.picks[i]);
+            }
+        }
+    }
+
+    for (auto it = cache.stale.cbegin(); it != cache.stale.cend(); ++it) {
+        rank_swap_rows(*it, *it + 1, memory, minimal_price, cache);
+        cache.is_stale[*it] = 0;
+    }
+    cache.stale.clear();
+}
+
+// Counts every feasible tabu swap as rejected or taken through aspiration,
+// the way a scan of all the swaps would. The swaps still tabu are the ones
+// recorded in the last tenure iterations, found in the history of the tabu
+// memory, so this is O(days) like the rest of the selection.
+void count_tabu_swaps(price_t current_price,
+                      price_t best_price,
+                      const tabu_memory_t &memory,
+                      const swap_cache_t &cache,
+                      neighbour_selection_t &selection) {
+
+    uint64_t first = std::max(memory.epoch, memory.iteration - std::min(memory.iteration, memory.tenure));
+    for (uint64_t stamp = first + 1; stamp <= memory.iteration; ++stamp) {
+        const neighbour_t &move = memory.history[stamp % memory.history.size()];
+        if (move.type != SWAP) continue;
+
+        // A swap recorded again later is counted by its last record
+        uint16_t i = move.key_i(), j = move.key_j();
+        if ((*memory.tabu[SWAP])(i, j) != stamp || !cache.is_feasible(i, j)) continue;
+
+        if (current_price + cache.delta[swap_cache_t::index(i, j)] < best_price) {
+            selection.aspiration++;
+        } else {
+            selection.tabu_rejected++;
+        }
+    }
+}
+
+// Offers the picks of every row in (i, j) order. The tabu pick is taken
+// when it beats the best price, that's the aspiration criterion. A row's
+// picks are offered by j, so ties go the same way as in a scan of all the
+// swaps. Other tabu swaps that beat the best price can only matter for
+// the penalized pick, which isn't used when any swap does.
+void select_swap_picks(uint16_t days_total,
+                       price_t current_price,
+                       price_t best_price,
+                       const tabu_memory_t &memory,
+                       uint16_t minimal_price,
+                       const swap_cache_t &cache,
+                       neighbour_selection_t &selection) {
+
+    for (uint16_t i = 2; i < days_total - 1; ++i) {
+        const swap_row_picks_t &picks = cache.picks[i];
+
+        uint16_t js[3];
+        int count = 0;
+        if (picks.free.j != 0) js[count++] = picks.free.j;
+        if (picks.penalized.j != 0) js[count++] = picks.penalized.j;
+        if (picks.tabu.j != 0 && current_price + picks.tabu.value < best_price) {
+            js[count++] = picks.tabu.j;
+        }
+        std::sort(js, js + count);
+
+        for (int k = 0; k < count; ++k) {
+            if (k > 0 && js[k] == js[k - 1]) continue;
+
+            uint16_t j = js[k];
+            price_t neighbour_price = current_price + cache.delta[swap_cache_t::index(i, j)];
+            selection.offer(neighbour_t(i, j, neighbour_price),
+                            neighbour_price + (price_t) minimal_price * memory.frequency(SWAP, i, j));
+        }
+    }
+}
+
+// Price of the route, price_table_t::MISSING when there's none
+int32_t route_price(const price_table_t * prices, uint16_t day, node_t * src, node_t * dest) {
+    if (prices != NULL) return prices->prices[prices->offset(day, src->idx, dest->idx)];
+
+    route_t * route = src->get_route(day, dest->idx);
+    return route != NULL ? route->price : price_table_t::MISSING;
+}
+
+// Running sums over the legs of a path, missing routes counted aside, so
+// any stretch of days is summed up in O(1)
+struct leg_sums_t {
+    void reset(uint16_t days_total) {
+        price.resize(days_total + 1);
+        missing.resize(days_total + 1);
+        price[0] = 0;
+        missing[0] = 0;
+    }
+
+    // Legs have to be set in day order
+    void set(uint16_t day, int32_t leg) {
+        bool is_missing = leg >= price_table_t::MISSING;
+        price[day + 1] = price[day] + (is_missing ? 0 : leg);
+        missing[day + 1] = missing[day] + is_missing;
+    }
+
+    // Legs of days first .. last - 1, -1 if one of them is missing
+    price_t range(uint16_t first, uint16_t last) const {
+        if (missing[last] != missing[first]) return -1;
+        return price[last] - price[first];
+    }
+
+    std::vector<price_t> price;
+    std::vector<uint16_t> missing;
+};
+
+// Relocation and reversal moves. Both fly a whole stretch of the path on
+// other days: relocating shifts the cities it jumps over by `length` days,
+// reversing flies the legs backwards. Prices of the shifted legs are summed
+// up front and reversals grow around a fixed centre one leg on each side at
+// a time, so that every move is O(1) after O(days) setup. A segment is
+// moved by and reversed over at most `span` days.
+void evaluate_segment_moves(uint16_t days_total,
+                            price_t current_price,
+                            const std::vector<route_t*> &path,
+                            price_t best_price,
+                            tabu_memory_t &memory,
+                            uint16_t minimal_price,
+                            const price_table_t * prices,
+                            unsigned int moves,
+                            uint16_t span,
+                            neighbour_selection_t &selection) {
+
+    static thread_local std::vector<node_t*> city;
+    static thread_local leg_sums_t flown, shifted;
+
+    const int32_t MISSING = price_table_t::MISSING;
+    const int d = days_total;
+
+    city.resize(d + 1);
+    flown.reset(d);
+    for (int k = 0; k < d; ++k) {
+        city[k] = path[k]->src;
+        flown.set(k, path[k]->price);
+    }
+    city[d] = path.back()->dest;
+
+    // Tabu and aspiration just like for the swaps. Long stretches of valid
+    // legs may sum up over MISSING, so callers check the legs one by one.
+    // Moves left out once a stretch misses a route aren't counted at all.
+    auto consider = [&](bool missing, price_t removed, price_t added, const neighbour_t &move) {
+        selection.priced++;
+        if (missing) {
+            selection.missing_route++;
+            return;
+        }
+        neighbour_t neighbour = move;
+        neighbour.price = current_price - removed + added;
+
+        if (memory.applies(neighbour)) {
+            if (neighbour.price < best_price) {
+                selection.aspiration++;
+            } else {
+                selection.tabu_rejected++;
+                return;
+            }
+        }
+
+        selection.offer(neighbour, neighbour.price + (price_t) minimal_price * memory.frequency(neighbour));
+    };
+
+    // Legs of the relocated segment itself, flown from day `day` on
+    auto segment_price = [&](int a, int length, int day) {
+        int32_t price = 0;
+        for (int t = 0; t + 1 < length; ++t) {
+            price += route_price(prices, day + t, city[a + t], city[a + t + 1]);
+        }
+        return price;
+    };
+
+    if (moves & (1 << RELOCATE)) {
+        for (int length = 1; length <= MAX_RELOCATE_LENGTH && d >= length + 2; ++length) {
+            // Segment a .. a + length - 1 forward to b, cities a + length .. b + length - 1
+            // fly `length` days earlier
+            shifted.reset(d);
+            for (int k = 0; k < d; ++k) {
+                shifted.set(k, k >= length ? route_price(prices, k - length, city[k], city[k + 1]) : MISSING);
+            }
+
+            for (int a = 1; a + length < d; ++a) {
+                int32_t enter = route_price(prices, a - 1, city[a - 1], city[a + length]);
+
+                for (int b = a + 1; b + length <= d && b - a <= span; ++b) {
+                    price_t between = shifted.range(a + length, b + length - 1);
+                    if (enter >= MISSING || between < 0) {
+                        // Only gets longer with b
+                        selection.priced++;
+                        selection.missing_route++;
+                        break;
+                    }
+
+                    int32_t join = route_price(prices, b - 1, city[b + length - 1], city[a]);
+                    int32_t segment = segment_price(a, length, b);
+                    int32_t leave = route_price(prices, b + length - 1, city[a + length - 1], city[b + length]);
+                    consider(join >= MISSING || segment >= MISSING || leave >= MISSING,
+                             flown.range(a - 1, b + length), enter + between + join + segment + leave,
+                             neighbour_t(a, b, 0, RELOCATE, length));
+                }
+            }
+
+            // Segment a .. a + length - 1 back to b, cities b .. a - 1 fly `length` days later
+            shifted.reset(d);
+            for (int k = 0; k < d; ++k) {
+                shifted.set(k, k + length < d ? route_price(prices, k + length, city[k], city[k + 1]) : MISSING);
+            }
+
+            for (int a = 2; a + length <= d; ++a) {
+                int32_t leave = route_price(prices, a + length - 1, city[a - 1], city[a + length]);
+
+                for (int b = a - 1; b >= 1 && a - b <= span; --b) {
+                    if (length == 1 && b == a - 1) continue;
+
+                    price_t between = shifted.range(b, a - 1);
+                    if (leave >= MISSING || between < 0) {
+                        selection.priced++;
+                        selection.missing_route++;
+                        break;
+                    }
+
+                    int32_t enter = route_price(prices, b - 1, city[b - 1], city[a]);
+                    int32_t segment = segment_price(a, length, b);
+                    int32_t join = route_price(prices, b + length - 1, city[a + length - 1], city[b]);
+                    consider(enter >= MISSING || segment >= MISSING || join >= MISSING,
+                             flown.range(b - 1, a + length), enter + segment + join + between + leave,
+                             neighbour_t(a, b, 0, RELOCATE, length));
+                }
+            }
+        }
+    }
+
+    if (moves & (1 << REVERSE)) {
+        // Reversing a .. b flies leg k (a <= k < b) backwards on day a + b - 1 - k,
+        // which stays the same while the segment grows around its centre
+        for (int centre = 3; centre <= 2 * d - 3; ++centre) {
+            int a, b;
+            price_t inner;
+            int32_t left, right;
+            if (centre % 2 == 1) {
+                a = centre / 2;
+                b = a + 1;
+                inner = 0;
+                left = route_price(prices, a, city[b], city[a]);
+                right = 0;
+            } else {
+                a = centre / 2 - 1;
+                b = centre / 2 + 1;
+                if (a < 1 || b >= d) continue;
+                inner = 0;
+                left = route_price(prices, a + 1, city[a + 1], city[a]);
+                right = route_price(prices, a, city[a + 2], city[a + 1]);
+            }
+
+            while (true) {
+                if (left >= MISSING || right >= MISSING) {
+                    selection.priced++;
+                    selection.missing_route++;
+                    break;
+                }
+                inner += left + right;
+
+                int32_t enter = route_price(prices, a - 1, city[a - 1], city[b]);
+                int32_t leave = route_price(prices, b, city[a], city[b + 1]);
+                consider(enter >= MISSING || leave >= MISSING,
+                         flown.range(a - 1, b + 1), enter + inner + leave, neighbour_t(b, a, 0, REVERSE));
+
+                if (a == 1 || b == d - 1 || b - a >= span) break;
+                left = route_price(prices, b, city[a], city[a - 1]);
+                right = route_price(prices, a - 1, city[b + 1], city[b]);
+                a--;
+                b++;
+            }
+        }
+    }
+}
+
+// First row of the given slice when rows 2 .. days_total - 2 are split
+// into parts of roughly the same number of (i, j) pairs
+uint16_t neighbour_row_split(uint16_t days_total, unsigned int part, unsigned int parts) {
+    if (part == 0) return 2;
+    if (part >= parts) return days_total - 1;
+
+    // Row i holds i - 1 pairs, so the work up to row i grows with i^2
+    uint16_t row = (uint16_t) ((days_total - 1) * sqrt((double) part / parts));
+    return std::min<uint16_t>(std::max<uint16_t>(row, 2), days_total - 1);
+}
+
+neighbour_t find_best_neighbour(uint16_t days_total,
+                                price_t current_price,
+                                std::vector<route_t*> &path,
+                                price_t best_price,
+                                tabu_memory_t &memory,
+                                uint16_t minimal_price,
+                                worker_pool_t * pool,
+                                const price_table_t * prices,
+                                unsigned int moves,
+                                segment_schedule_t * schedule,
+                                swap_cache_t &cache,
+                                search_stats_t * stats) {
+
+    unsigned int parts = 1;
+    if (pool != NULL && days_total >= PARALLEL_NEIGHBOURHOOD_MIN_DAYS) parts = pool->size();
+
+    // Reused between calls, the search itself allocates nothing. Workers have
+    // to go through the reference, they'd see their own thread_local otherwise.
+    static thread_local std::vector<neighbour_selection_t> thread_selections;
+    std::vector<neighbour_selection_t> &selections = thread_selections;
+    selections.assign(parts, neighbour_selection_t());
+
+    static thread_local dense_path_t dense_path;
+    if (prices != NULL) dense_path.assign(path, *prices);
+
+    if (moves & (1 << SWAP)) {
+        // Only the rows and columns changed by the moves since the last
+        // iteration are priced again, unless that's most of them
+        bool refill = !cache.filled || cache.dirty.size() * 4 >= days_total ||
+                      (cache.candidates > 0 && cache.until_refill == 0);
+        if (refill) {
+            cache.filled = true;
+            if (parts == 1) {
+                price_swap_rows(2, days_total - 1, path, prices, &dense_path,
+                                cache, selections[0]);
+            } else {
+                const dense_path_t &shared_dense_path = dense_path;
+                pool->run([&](unsigned int part) {
+                    price_swap_rows(neighbour_row_split(days_total, part, parts),
+                                    neighbour_row_split(days_total, part + 1, parts),
+                                    path, prices, &shared_dense_path,
+                                    cache, selections[part]);
+                });
+            }
+            if (cache.candidates > 0) cache.restrict_to_candidates();
+        } else if (cache.candidates > 0) {
+            for (auto it = cache.moved.cbegin(); it != cache.moved.cend(); ++it) {
+                price_swap_rows(*it, *it + 1, path, prices, &dense_path, cache, selections[0]);
+                price_swap_column(days_total, *it, path, prices, &dense_path, cache, selections[0]);
+                cache.choose_candidates(*it);
+            }
+            for (auto it = cache.dirty.cbegin(); it != cache.dirty.cend(); ++it) {
+                if (!cache.is_moved[*it]) price_swap_candidates(*it, path, prices, &dense_path, cache, selections[0]);
+            }
+            cache.until_refill--;
+        } else {
+            for (auto it = cache.dirty.cbegin(); it != cache.dirty.cend(); ++it) {
+                price_swap_rows(*it, *it + 1, path, prices, &dense_path,
+                                cache, selections[0]);
+                price_swap_column(days_total, *it, path, prices, &dense_path,
+                                  cache, selections[0]);
+            }
+        }
+
+        // All the picks are found again after a refill or when the tabu
+        // status of more than the last move's swaps may have changed
+        if (refill || cache.ranked_epoch != memory.epoch || memory.iteration - cache.ranked_iteration > 1) {
+            if (parts == 1) {
+                rank_swap_rows(2, days_total - 1, memory, minimal_price, cache);
+            } else {
+                pool->run([&](unsigned int part) {
+                    rank_swap_rows(neighbour_row_split(days_total, part, parts),
+                                   neighbour_row_split(days_total, part + 1, parts),
+                                   memory, minimal_price, cache);
+                });
+            }
+        } else {
+            update_swap_picks(memory, minimal_price, cache);
+        }
+        cache.ranked_iteration = memory.iteration;
+        cache.ranked_epoch = memory.epoch;
+        cache.clear_dirty();
+        cache.clear_moved();
+
+        select_swap_picks(days_total, current_price, best_price, memory, minimal_price, cache, selections[0]);
+        if (stats != NULL) count_tabu_swaps(current_price, best_price, memory, cache, selections[0]);
+        for (unsigned int part = 1; part < parts; ++part) {
+            selections[0].merge(selections[part]);
+        }
+
+        // Nothing admissible left on the candidate lists, the next iteration
+        // refills them unless they hold all the swaps there were
+        if (cache.candidates > 0 && cache.dropped && selections[0].best.i == 0) cache.filled = false;
+    }
+
+    bool segments = (moves & ~(1 << SWAP)) != 0;
+    if (segments && schedule != NULL && !schedule->due()) {
+        schedule->skipped();
+        segments = selections[0].best.i == 0;
+    }
+
+    static thread_local neighbour_selection_t segment_selection;
+    segment_selection = neighbour_selection_t();
+    if (segments) {
+        if (schedule != NULL) schedule->evaluated();
+        uint16_t span = cache.candidates > 0 ? CANDIDATE_SEGMENT_SPAN : days_total;
+        evaluate_segment_moves(days_total, current_price, path, best_price, memory,
+                               minimal_price, prices, moves, span, segment_selection);
+    }
+
+    if (stats != NULL) {
+        for (unsigned int part = 0; part < parts; ++part) {
+            stats->count(selections[part]);
+        }
+        stats->count(segment_selection);
+    }
+
+    // Swaps go before the segment moves
+    selections[0].merge(segment_selection);
+    const neighbour_t &best_neighbour = selections[0].best;
+
+    //std::cerr << "Returning best neighbour with price " << best_neighbour.price << std::endl;
+    //std::cerr << "i=" << best_neighbour.i << " j=" << best_neighbour.j << std::endl;
+
+    if (best_neighbour.i == 0) {
+        // No applicable neighbours
+        return best_neighbour;
+    }
+
+    if (best_neighbour.price < best_price) {
+        return best_neighbour;
+    } else {
+        /*
+        std::cerr << "No interesting neighbour, picking by frequency-penalized price" << std::endl;
+        std::cerr << selections[0].penalized.i << std::endl;
+        std::cerr << selections[0].penalized.j << std::endl;
+        */
+        if (stats != NULL) stats->penalized_picks++;
+        return selections[0].penalized;
+    }
+
+
+}
+
+void recalculate_price(const std::vector<route_t*> &path, price_t * price) {
+    *price = 0;
+    for (auto it = path.cbegin(); it != path.cend(); ++it) {
+        *price += (*it)->price;
+    }
+}
+
+
+// Best distinct local optima found so far. Restarts go through them in turn.
+struct elite_pool_t {
+    struct solution_t {
+        std::vector<route_t*> path;
+        price_t price;
+    };
+
+    elite_pool_t(size_t capacity) : capacity(capacity), next_restart(0) {};
+
+    void offer(const std::vector<route_t*> &path, price_t price) {
+        if (capacity == 0) return;
+
+        auto worst = solutions.begin();
+        for (auto it = solutions.begin(); it != solutions.end(); ++it) {
+            if (it->price == price && it->path == path) return;
+            if (it->price > worst->price) worst = it;
+        }
+
+        if (solutions.size() < capacity) {
+            solution_t solution = { path, price };
+            solutions.push_back(solution);
+        } else if (worst->price > price) {
+            worst->path = path;
+            worst->price = price;
+        }
+    }
+
+    const solution_t & next() {
+        next_restart = (next_restart + 1) % solutions.size();
+        return solutions[next_restart];
+    }
+
+    size_t capacity;
+    size_t next_restart;
+    std::vector<solution_t> solutions;
+};
+
+// Applies up to `size` of the least used feasible swaps, in order of use,
+// and returns how many there were
+unsigned int kick_path(std::vector<route_t*> &path, tabu_memory_t &memory,
+                       unsigned int size, deadline_t &deadline) {
+    const frequency_order_t &order = memory.swap_order;
+
+    // Recorded only afterwards, that reorders the pairs
+    static thread_local std::vector<neighbour_t> applied;
+    applied.clear();
+    for (size_t k = 0; k < order.order.size() && applied.size() < size && !deadline.expired(); ++k) {
+        uint32_t pair = order.order[k];
+        neighbour_t neighbour(order.pair_i[pair], order.pair_j[pair], 0);
+        if (neighbour.try_apply(path)) applied.push_back(neighbour);
+    }
+
+    for (auto it = applied.cbegin(); it != applied.cend(); ++it) {
+        memory.record(*it);
+    }
+    return applied.size();
+}
+
+// Returns the number of iterations done. When no new best price turns up
+// for a while the search is kicked with the least used swaps, after a few
+// fruitless kicks it restarts from one of the best solutions seen. The
+// neighbourhood is split over pool unless that's NULL.
+uint64_t tabu_search(node_t * start, uint16_t days_total, std::vector<route_t*> &best_path,
+                     price_t &best_price, uint16_t minimal_price, shared_best_t * shared,
+                     worker_pool_t * pool, const price_table_t * prices,
+                     const search_options_t &options,
+                     deadline_t deadline, search_stats_t * stats) {
+
+    std::vector<route_t*> current_path = best_path;
+    price_t current_price = best_price;
+
+    // Best solution since the last kick, goes to the elite pool
+    std::vector<route_t*> phase_path = current_path;
+    price_t phase_price = current_price;
+
+    tabu_memory_t memory(days_total);
+    swap_cache_t cache(days_total, days_total >= CANDIDATE_LIST_MIN_DAYS ? options.candidates : 0);
+    elite_pool_t elite(options.elite_size);
+
+    int segment_period = options.segment_period;
+    if (segment_period == 0) {
+        segment_period = days_total >= SEGMENT_SCHEDULE_MIN_DAYS ? days_total / SEGMENT_SHARE : 1;
+        // As often as the candidate lists are refilled
+        if (cache.candidates > 0) segment_period = days_total;
+    }
+    std::unique_ptr<segment_schedule_t> schedule;
+    if (segment_period > 1 && (options.moves & (1 << SWAP))) schedule.reset(new segment_schedule_t(segment_period));
+
+    unsigned int kick_size = std::max<unsigned int>(days_total / KICK_SHARE, KICK_MIN_SWAPS);
+
+    int iter_since_improvement = 0;
+    int kicks_since_improvement = 0;
+    uint64_t iterations = 0;
+
+    while (!deadline.expired()) {
+        iterations++;
+        neighbour_t neighbour = find_best_neighbour(days_total, current_price,
+                                                    current_path, best_price,
+                                                    memory, minimal_price, pool,
+                                                    prices, options.moves, schedule.get(), cache, stats);
+
+        if (neighbour.i != 0) {
+            neighbour.apply(current_path);
+            memory.record(neighbour);
+            cache.touch(neighbour, best_price);
+            if (schedule != NULL) schedule->touch(neighbour, best_price);
+            current_price = neighbour.price;
+            if (neighbour.price < phase_price) {
+                phase_path = current_path;
+                phase_price = current_price;
+            }
+            if (neighbour.price < best_price) {
+                iter_since_improvement = 0;
+                kicks_since_improvement = 0;
+                best_path = current_path;
+                best_price = current_price;
+
+                // With more threads only improvements of the global best go to the trace
+                bool global = shared == NULL || shared->publish(best_path, best_price);
+                if (stats != NULL && global) stats->record(iterations, best_price);
+            } else {
+                iter_since_improvement++;
+            }
+        } else {
+            //std::cerr << "No applicable neighbour" << std::endl;
+            iter_since_improvement++;
+        }
+
+        if (options.stagnation > 0 && iter_since_improvement >= options.stagnation) {
+            elite.offer(phase_path, phase_price);
+            if (kicks_since_improvement >= KICKS_BEFORE_RESTART && !elite.solutions.empty()) {
+                current_path = elite.next().path;
+                kicks_since_improvement = 0;
+                if (stats != NULL) stats->restarts++;
+            }
+
+            kick_path(current_path, memory, kick_size, deadline);
+            memory.clear_tabu();
+            recalculate_price(current_path, &current_price);
+            cache.filled = false;
+            if (schedule != NULL) schedule->until_due = 0;
+
+            phase_path = current_path;
+            phase_price = current_price;
+            iter_since_improvement = 0;
+            kicks_since_improvement++;
+            if (stats != NULL) stats->kicks++;
+        }
+    }
+
+    if (stats != NULL) stats->iterations += iterations;
+    return iterations;
+}
+
+// Moves the starting point of a worker away from the initial solution by
+// applying random feasible swaps, so the threads explore different regions
+void perturb_path(uint16_t days_total, std::vector<route_t*> &path, price_t &price,
+                  unsigned int seed) {
+    if (days_total < 4) return;
+
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<uint16_t> pick_i(2, days_total - 2);
+
+    for (int k = 0; k < days_total; ++k) {
+        uint16_t i = pick_i(random);
+        uint16_t j = std::uniform_int_distribution<uint16_t>(1, i - 1)(random);
+        neighbour_t(i, j, 0).try_apply(path);
+    }
+
+    recalculate_price(path, &price);
+}
+
+// Returns the number of iterations done by all search threads together
+uint64_t parallel_tabu_search(node_t * start, uint16_t days_total, std::vector<route_t*> &path,
+                              price_t &total_price, uint16_t minimal_price, solver_threads_t &solver_threads,
+                              const price_table_t * prices,
+                              const search_options_t &options,
+                              const deadline_t &deadline, search_stats_t * stats) {
+    unsigned int threads = solver_threads.threads;
+    if (threads <= 1) {
+        return tabu_search(start, days_total, path, total_price, minimal_price, NULL, solver_threads.eval(0), prices,
+                           options, deadline, stats);
+    }
+
+    // Started here, the search threads would race for them
+    std::vector<worker_pool_t*> eval_pools(threads);
+    for (unsigned int t = 0; t < threads; ++t) {
+        eval_pools[t] = solver_threads.eval(t);
+    }
+
+    // Worker traces count from the same start as the caller's
+    search_stats_t blank(stats != NULL ? stats->started : deadline_t::clock_t::now());
+    std::vector<search_stats_t> worker_stats(threads, blank);
+
+    shared_best_t shared(path, total_price);
+    std::atomic<uint64_t> iterations(0);
+
+    solver_threads.search().run([&](unsigned int t) {
+        std::vector<route_t*> worker_path = path;
+        price_t worker_price = total_price;
+
+        // First worker continues from the initial solution as is
+        if (t > 0) perturb_path(days_total, worker_path, worker_price, t);
+
+        iterations += tabu_search(start, days_total, worker_path, worker_price, minimal_price, &shared,
+                                  eval_pools[t], prices, options, deadline,
+                                  stats != NULL ? &worker_stats[t] : NULL);
+        shared.publish(worker_path, worker_price);
+    });
+
+    if (stats != NULL) {
+        for (auto it = worker_stats.cbegin(); it != worker_stats.cend(); ++it) {
+            stats->add(*it);
+        }
+    }
+
+    path = shared.path;
+    total_price = shared.price;
+
+    return iterations;
+}
+
+// What a run did and where the time went, written as JSON by --report
+struct run_report_t {
+    run_report_t() : nodes(0), days(0), flights(0), read_ms(0), construct_ms(0),
+        setup_ms(0), tabu_ms(0), exact_ms(0), tabu_iterations(0), moves_priced(0),
+        initial_price(-1), price(-1), exact(false), proven_optimal(false) {};
+
+    static double since(deadline_t::clock_t::time_point &mark) {
+        deadline_t::clock_t::time_point now = deadline_t::clock_t::now();
+        double ms = std::chrono::duration<double, std::milli>(now - mark).count();
+        mark = now;
+        return ms;
+    }
+
+    // Batch mode names the instance in the first field
+    void write(std::ostream &out, const char * input = NULL) const {
+        double tabu_seconds = tabu_ms / 1000;
+        out << "{";
+        if (input != NULL) {
+            out << "\"input\": ";
+            write_json_string(out, input);
+            out << ", ";
+        }
+        out << "\"nodes\": " << nodes
+            << ", \"days\": " << days
+            << ", \"flights\": " << flights
+            << ", \"read_ms\": " << read_ms
+            << ", \"construct_ms\": " << construct_ms
+            << ", \"setup_ms\": " << setup_ms
+            << ", \"tabu_ms\": " << tabu_ms
+            << ", \"exact_ms\": " << exact_ms
+            << ", \"tabu_iterations\": " << tabu_iterations
+            << ", \"moves_priced\": " << moves_priced
+            << ", \"moves_priced_per_second\": " << (tabu_seconds > 0 ? moves_priced / tabu_seconds : 0)
+            << ", \"initial_price\": " << initial_price
+            << ", \"price\": " << price
+            << ", \"exact\": " << (exact ? "true" : "false")
+            << ", \"proven_optimal\": " << (proven_optimal ? "true" : "false")
+            << "}" << std::endl;
+    }
+
+    size_t nodes, days, flights;
+    double read_ms, construct_ms, setup_ms, tabu_ms, exact_ms;
+    uint64_t tabu_iterations, moves_priced;
+    price_t initial_price, price;
+    bool exact, proven_optimal;
+};
+
+// Command line settings, the same for every instance of a batch
+struct run_options_t {
+    run_options_t() : threads(1), eval_threads(1), dense_prices_limit(DENSE_PRICES_DEFAULT_LIMIT),
+        time_limit(DEFAULT_TIME_LIMIT_MS), exact_max_days(DEFAULT_EXACT_MAX_DAYS), format(TEXT_OUTPUT),
+        pipelined_ingest(std::thread::hardware_concurrency() > 1), ingest_threads(0), fast_parser(true),
+        early_construction(std::thread::hardware_concurrency() > 2), collect_stats(false) {};
+
+    unsigned int threads;
+    unsigned int eval_threads;
+    search_options_t search;
+    size_t dense_prices_limit;
+    long time_limit;  // Per instance, from when its reading starts, see solve_instance()
+    int exact_max_days;
+    output_format_t format;
+    bool pipelined_ingest;  // Parse on a thread of its own, pays off with a core to spare
+    unsigned int ingest_threads;  // Parse large inputs in that many pieces at once, 0 picks by the cores
+    bool fast_parser;       // flight_scanner_t rather than the CSV reader
+    bool early_construction;  // Start the DFS on the days read so far when pipelined, needs a third core
+    bool collect_stats;     // Search counters and improvement trace, for --telemetry and --report
+};
+
+enum solve_status_t { SOLVED, NO_PATH, BAD_INPUT };
+
+// Memory a thread keeps between the instances it solves, so that a batch or
+// a server doesn't allocate the graph and the price table for each of them
+struct solver_buffers_t {
+    arena_t arena;  // Owns all nodes and routes
+    std::vector<node_t*> nodes;
+    price_table_t prices;
+    std::unique_ptr<mapped_file_t> graph_file;  // Of a compiled instance
+    output_buffer_t output;
+};
+
+// Loaded instance, its nodes are in the solver_buffers_t
+struct instance_t {
+    instance_t() : start(NULL), days_total(0), minimal_price(0), early(NULL) {};
+
+    node_t *start;
+    uint16_t days_total;
+    uint16_t minimal_price;
+    early_construction_t *early;  // Of the solver_threads_t, still running after a pipelined read
+};
+
+void clear_instance(solver_buffers_t &buffers) {
+    buffers.arena.reset();
+    buffers.nodes.clear();
+    buffers.graph_file.reset();
+}
+
+// Reads a text instance, errors go to stderr
+template <typename reader_t>
+bool read_instance(reader_t &reader, const run_options_t &options, solver_buffers_t &buffers,
+                   solver_threads_t &threads, instance_t &instance) {
+    clear_instance(buffers);
+    instance.minimal_price = 0;
+    instance.early = NULL;
+
+    //std::cerr << "Loading " << std::endl;
+    try {
+        instance.days_total = read_input(reader, buffers.arena, buffers.nodes, instance.start,
+                                         instance.minimal_price, options.pipelined_ingest, options.early_construction,
+                                         threads, instance.early);
+    } catch (const io::error::base &err) {
+        std::cerr << err.what() << std::endl;
+        if (instance.early != NULL) instance.early->cancel();
+        return false;
+    } catch (const input_error_t &err) {
+        std::cerr << err.what() << std::endl;
+        if (instance.early != NULL) instance.early->cancel();
+        return false;
+    }
+    //std::cerr << "Loading done" << std::endl;
+    return true;
+}
+
+// Loads input_file, stdin if NULL. Compiled graphs are recognized by their
+// magic. Files are mapped into memory, stdin goes through the stream.
+bool load_instance(const char * input_file, const run_options_t &options, solver_buffers_t &buffers,
+                   solver_threads_t &threads, instance_t &instance) {
+    std::unique_ptr<mapped_file_t> file;
+    std::unique_ptr<input_reader_t> reader;
+    std::unique_ptr<flight_scanner_t> scanner;
+    try {
+        if (input_file != NULL) {
+            file.reset(new mapped_file_t(input_file));
+            if (file->data != NULL && is_compiled_graph(file->data, file->size)) {
+                clear_instance(buffers);
+                try {
+                    instance.days_total = load_graph(*file, buffers.arena, buffers.nodes,
+                                                     instance.start, instance.minimal_price);
+                } catch (const std::runtime_error &err) {
+                    std::cerr << input_file << ": " << err.what() << std::endl;
+                    return false;
+                }
+                buffers.graph_file = std::move(file);
+                return true;
+            } else if (file->data != NULL && options.fast_parser) {
+                scanner.reset(new flight_scanner_t(input_file, file->data, file->data + file->size));
+            } else if (file->data != NULL) {
+                reader.reset(new input_reader_t(input_file, file->data, file->data + file->size));
+            } else if (options.fast_parser) {
+                // A pipe, a FIFO or an empty file is read as a stream
+                if (file->fd < 0) {
+                    std::cerr << "Can't open " << input_file << ": " << strerror(file->error) << std::endl;
+                    return false;
+                }
+                scanner.reset(new flight_scanner_t(input_file, file->fd));
+            } else {
+                // Empty, not mappable, or lets the reader report why it can't be opened
+                file.reset();
+                reader.reset(new input_reader_t(input_file));
+            }
+        } else if (options.fast_parser) {
+            scanner.reset(new flight_scanner_t("stdin", STDIN_FILENO));
+        } else {
+            reader.reset(new input_reader_t("stdin", std::cin));
+        }
+    } catch (const io::error::base &err) {
+        std::cerr << err.what() << std::endl;
+        return false;
+    }
+
+    if (scanner) return read_instance(*scanner, options, buffers, threads, instance);
+    return read_instance(*reader, options, buffers, threads, instance);
+}
+
+// Solves a loaded instance and formats the solution into the buffers' output
+// in the format of the options, the caller writes it out. The time limit
+// counts from stats.started, so it includes the loading. When the loading
+// took nearly all of it, the construction still gets MIN_CONSTRUCTION_MS
+// to find a first path, which is then the answer. All state lives here, in
+// the buffers and in the threads, so any number of instances can be solved
+// at once with a set of each.
+// Messages are prefixed with label.
+solve_status_t solve_instance(const instance_t &instance, const char * label,
+                              const run_options_t &options, solver_buffers_t &buffers, solver_threads_t &threads,
+                              run_report_t &report, search_stats_t &stats) {
+    const std::vector<node_t*> &nodes = buffers.nodes;
+    node_t* start = instance.start;
+    uint16_t minimal_price = instance.minimal_price;
+    uint16_t days_total = instance.days_total;
+
+    deadline_t::clock_t::time_point mark = stats.started;
+    report.read_ms = run_report_t::since(mark);
+    report.nodes = nodes.size();
+    report.days = days_total;
+    report.flights = nodes.empty() ? 0 : nodes.back()->day_offsets[days_total];
+
+    std::vector<route_t *> path;
+    price_t total_price = 0;
+
+    bool exact = days_total <= options.exact_max_days;
+    report.exact = exact;
+
+    deadline_t deadline(stats.started + std::chrono::milliseconds(options.time_limit));
+    deadline_t construction_deadline(std::max(deadline.end, mark + std::chrono::milliseconds(MIN_CONSTRUCTION_MS)));
+
+    // After a pipelined read the DFS may be done already, else it runs now
+    early_construction_t::status_t early = early_construction_t::GAVE_UP;
+    if (instance.early != NULL) early = instance.early->finish(nodes, construction_deadline.end, path, total_price);
+
+    bool found = early == early_construction_t::FOUND;
+    if (early == early_construction_t::GAVE_UP) {
+        found = depth_search(start, days_total, nodes.size(), path, total_price, construction_deadline);
+    } else if (early == early_construction_t::OUT_OF_TIME) {
+        std::cerr << "Out of time, no circle" << std::endl;
+    } else if (early == early_construction_t::DEPLETED) {
+        std::cerr << "Stack depleted, no circle" << std::endl;
+    }
+    report.construct_ms = run_report_t::since(mark);
+
+    if (!found) return NO_PATH;
+    report.initial_price = total_price;
+
+    // The tabu search only counts when someone reads the counts
+    search_stats_t *search_stats = options.collect_stats ? &stats : NULL;
+    if (search_stats != NULL) search_stats->record(0, total_price);
+
+    const price_table_t *prices = NULL;
+    if (price_table_t::fits(nodes.size(), days_total, options.dense_prices_limit)) {
+        buffers.prices.build(nodes, days_total);
+        prices = &buffers.prices;
+    }
+    report.setup_ms = run_report_t::since(mark);
+
+    // Small instances are usually proven right away from the DFS path
+    double probe_ms = 0;
+    if (exact) {
+        deadline_t::clock_t::time_point now = deadline_t::clock_t::now();
+        deadline_t probe_deadline = deadline;
+        if (now < deadline.end) probe_deadline = deadline_t(now + (deadline.end - now) / EXACT_PROBE_SHARE);
+        branch_and_bound_t probe(nodes, start, days_total, probe_deadline);
+        report.proven_optimal = probe.solve(path, total_price);
+        probe_ms = run_report_t::since(mark);
+    }
+
+    if (!report.proven_optimal) {
+        // In exact mode the tabu search only finds a better incumbent to prune with
+        deadline_t tabu_deadline = deadline;
+        if (exact) {
+            deadline_t::clock_t::time_point now = deadline_t::clock_t::now();
+            if (now < deadline.end) tabu_deadline = deadline_t(now + (deadline.end - now) / EXACT_TABU_SHARE);
+        }
+
+        report.tabu_iterations = parallel_tabu_search(start, days_total, path, total_price, minimal_price,
+                                                      threads, prices,
+                                                      options.search, tabu_deadline, search_stats);
+        report.moves_priced = stats.moves_priced;
+    }
+    report.tabu_ms = run_report_t::since(mark);
+
+    if (exact) {
+        if (!report.proven_optimal) {
+            branch_and_bound_t branch_and_bound(nodes, start, days_total, deadline);
+            report.proven_optimal = branch_and_bound.solve(path, total_price);
+        }
+        if (label != NULL) std::cerr << label << ": ";
+        if (report.proven_optimal) {
+            std::cerr << "Proven optimal" << std::endl;
+        } else {
+            std::cerr << "Out of time, optimality not proven" << std::endl;
+        }
+        report.exact_ms = probe_ms + run_report_t::since(mark);
+    }
+
+    buffers.output.format(path, total_price, options.format);
+
+    report.price = total_price;
+    return SOLVED;
+}
+
+solve_status_t solve_file(const char * input_file, const run_options_t &options, solver_buffers_t &buffers,
+                          solver_threads_t &threads, run_report_t &report, search_stats_t &stats) {
+    instance_t instance;
+    if (!load_instance(input_file, options, buffers, threads, instance)) return BAD_INPUT;
+    return solve_instance(instance, input_file, options, buffers, threads, report, stats);
+}
+
+// Batch mode writes the solution of FILE to FILE.out, or into --output-dir
+const char * const OUTPUT_SUFFIX = ".out";
+
+// Adds path, or the regular files in it if it's a directory, in name order.
+// Hidden files and earlier outputs are left out.
+bool list_inputs(const std::string &path, std::vector<std::string> &inputs) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+    if (!S_ISDIR(info.st_mode)) {
+        inputs.push_back(path);
+        return true;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL) return false;
+
+    std::vector<std::string> files;
+    size_t suffix_length = strlen(OUTPUT_SUFFIX);
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name(entry->d_name);
+        if (name[0] == '.') continue;
+        if (name.size() >= suffix_length && name.compare(name.size() - suffix_length, suffix_length, OUTPUT_SUFFIX) == 0) continue;
+
+        std::string file = path + "/" + name;
+        if (stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode)) files.push_back(file);
+    }
+    closedir(dir);
+
+    std::sort(files.begin(), files.end());
+    inputs.insert(inputs.end(), files.begin(), files.end());
+    return true;
+}
+
+// Solves the instances on `jobs` threads of one process, every thread takes
+// the next instance not started yet. Reports and telemetry are written as
+// one JSON line per instance. Returns the number of instances not solved.
+size_t solve_batch(const std::vector<std::string> &inputs, const char * output_dir, unsigned int jobs,
+                   const run_options_t &options, const char * report_file, const char * telemetry_file) {
+    if (inputs.empty()) return 0;
+
+    std::unique_ptr<std::ofstream> report_out, telemetry_out;
+    if (report_file != NULL) report_out.reset(new std::ofstream(report_file));
+    if (telemetry_file != NULL) telemetry_out.reset(new std::ofstream(telemetry_file));
+    std::mutex lock;  // Guards the report and telemetry files
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(0);
+
+    worker_pool_t pool(std::min<size_t>(jobs, inputs.size()));
+    pool.run([&](unsigned int) {
+        solver_buffers_t buffers;
+        solver_threads_t threads(options.threads, options.eval_threads, options.ingest_threads);
+        size_t k;
+        while ((k = next++) < inputs.size()) {
+            const char *input = inputs[k].c_str();
+
+            std::string output;
+            if (output_dir != NULL) {
+                size_t slash = inputs[k].rfind('/');
+                output = std::string(output_dir) + "/" + inputs[k].substr(slash == std::string::npos ? 0 : slash + 1);
+            } else {
+                output = inputs[k];
+            }
+            output += OUTPUT_SUFFIX;
+
+            run_report_t report;
+            search_stats_t stats;
+            solve_status_t status = solve_file(input, options, buffers, threads, report, stats);
+            if (status == SOLVED) {
+                int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0 || !buffers.output.write_to(fd)) {
+                    std::cerr << "Can't write " << output << std::endl;
+                    failed++;
+                }
+                if (fd >= 0) close(fd);
+            } else {
+                failed++;
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            if (report_out && status != BAD_INPUT) report.write(*report_out, input);
+            if (telemetry_out && status == SOLVED) stats.write(*telemetry_out, input);
+        }
+    });
+
+    return failed;
+}
+
+// Milliseconds up to the end of the line, 0 if that's not a positive number
+long parse_time_limit(const char * value) {
+    char *end;
+    errno = 0;
+    long time_limit = strtol(value, &end, 10);
+    if (end == value || errno != 0 || time_limit <= 0) return 0;
+    while (*end == ' ' || *end == '\r') ++end;
+    return *end == '\0' || *end == '\n' ? time_limit : 0;
+}
+
+// Comma separated move types, 0 if there's an unknown one
+unsigned int parse_moves(const char * value) {
+    static const char * const names[MOVE_TYPES] = { "swap", "relocate", "reverse" };
+
+    unsigned int moves = 0;
+    std::string list(value);
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        std::string name = list.substr(begin, end - begin);
+
+        int type = 0;
+        while (type < MOVE_TYPES && name != names[type]) ++type;
+        if (type == MOVE_TYPES) return 0;
+        moves |= 1 << type;
+
+        begin = end + 1;
+    }
+    return moves;
+}
+
+bool parse_format(const char * value, output_format_t &format) {
+    static const char * const names[] = { "text", "json", "binary" };
+    for (int candidate = TEXT_OUTPUT; candidate <= BINARY_OUTPUT; ++candidate) {
+        if (strcmp(value, names[candidate]) == 0) {
+            format = (output_format_t) candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int parse_threads(const char * value) {
+    if (strcmp(value, "auto") == 0) {
+        unsigned int threads = std::thread::hardware_concurrency();
+        return threads > 0 ? threads : 1;
+    }
+
+    int threads = atoi(value);
+    return threads > 0 ? threads : 1;
+}
+
+
+// A request may start with this line to set its own time limit
+const char * const TIME_LIMIT_HEADER = "time-limit ";
+const size_t READ_CHUNK = 64 << 10;
+
+// A client that takes longer than that to send its whole request, or
+// sends more than that much, is dropped so that it can't hold a thread of
+// the server
+const int REQUEST_TIMEOUT_S = 10;
+const size_t MAX_REQUEST_BYTES = (size_t) 1 << 30;
+
+// Pause of a worker after a failed accept() before it tries again
+const int ACCEPT_BACKOFF_MS = 100;
+
+// Reads until the client shuts down its side, reusing the request's storage.
+// False with a message in error if the client is dropped.
+bool read_request(int fd, std::string &request, std::string &error) {
+    typedef std::chrono::steady_clock clock_t;
+    clock_t::time_point deadline = clock_t::now() + std::chrono::seconds(REQUEST_TIMEOUT_S);
+
+    size_t size = 0;
+    while (true) {
+        if (size == MAX_REQUEST_BYTES) {
+            error = "too large";
+            return false;
+        }
+
+        // Waits only for what's left of the deadline, a client sending a
+        // byte at a time doesn't get more
+        long remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock_t::now()).count();
+        pollfd readable = {fd, POLLIN, 0};
+        int ready = remaining_ms > 0 ? poll(&readable, 1, remaining_ms) : 0;
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready == 0) {
+            error = "timed out";
+            return false;
+        }
+        if (ready < 0) {
+            error = strerror(errno);
+            return false;
+        }
+
+        if (request.size() < size + READ_CHUNK) request.resize(std::min(size + READ_CHUNK, MAX_REQUEST_BYTES));
+        ssize_t got = read(fd, &request[size], request.size() - size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        if (got == 0) break;
+        size += got;
+    }
+    request.resize(size);
+    return true;
+}
+
+// Solves instances sent to a Unix socket until killed. A client connects,
+// sends an instance in the input format, optionally preceded by a
+// "time-limit MS" line, and shuts down its sending side. It gets back what
+// kiwi would print, nothing if there's no solution. The `jobs` threads,
+// their buffers and the threads each of them solves with stay for all the
+// requests, messages on stderr are labeled "request N" in the order the
+// requests were accepted.
+int serve(const char * socket_path, unsigned int jobs, const run_options_t &options) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Can't create socket: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << std::endl;
+        close(listener);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    // A socket left over by an earlier server goes, anything else there stays
+    struct stat existing;
+    if (lstat(socket_path, &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            std::cerr << "Not a socket, won't replace it: " << socket_path << std::endl;
+            close(listener);
+            return 1;
+        }
+        unlink(socket_path);
+    }
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Can't listen on " << socket_path << ": " << strerror(errno) << std::endl;
+        close(listener);
+        return 1;
+    }
+
+    // A client gone away must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    // Messages name the request by its number
+    std::atomic<uint64_t> requests(0);
+
+    worker_pool_t pool(jobs);
+    pool.run([&](unsigned int) {
+        solver_buffers_t buffers;
+        solver_threads_t threads(options.threads, options.eval_threads, options.ingest_threads);
+        std::string request, error;
+
+        while (true) {
+            int client = accept(listener, NULL, NULL);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                // Out of descriptors or memory passes once clients hang up,
+                // the worker backs off instead of leaving the pool for good
+                std::cerr << "Can't accept: " << strerror(errno) << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_BACKOFF_MS));
+                continue;
+            }
+
+            std::string label = "request " + std::to_string(++requests);
+            if (!read_request(client, request, error)) {
+                std::cerr << label << ": " << error << std::endl;
+            } else if (!request.empty()) {
+                // The budget counts from here, a slow client doesn't eat it
+                run_report_t report;
+                search_stats_t stats;
+                run_options_t request_options = options;
+
+                const char *begin = request.data();
+                const char *end = begin + request.size();
+                size_t header_length = strlen(TIME_LIMIT_HEADER);
+                if (request.compare(0, header_length, TIME_LIMIT_HEADER) == 0) {
+                    request_options.time_limit = parse_time_limit(begin + header_length);
+                    if (request_options.time_limit == 0) {
+                        std::cerr << label << ": invalid time limit" << std::endl;
+                        close(client);
+                        continue;
+                    }
+                    begin = std::find(begin, end, '\n');
+                    if (begin != end) ++begin;
+                }
+
+                instance_t instance;
+                bool loaded;
+                if (options.fast_parser) {
+                    flight_scanner_t scanner(label, begin, end);
+                    loaded = read_instance(scanner, options, buffers, threads, instance);
+                } else {
+                    input_reader_t reader(label, begin, end);
+                    loaded = read_instance(reader, options, buffers, threads, instance);
+                }
+                if (loaded &&
+                    solve_instance(instance, label.c_str(), request_options, buffers, threads, report, stats) == SOLVED) {
+                    buffers.output.write_to(client);
+                }
+            }
+            close(client);
+        }
+    });
+
+    close(listener);
+    return 1;
+}
+
+int usage(const char * program) {
+    std::cerr << "Usage: " << program << " [--threads N|auto] [--eval-threads N|auto] [--moves swap,relocate,reverse] [--segment-period N] [--candidates N] [--stagnation N] [--elite N] [--dense-prices-mb N] [--time-limit MS] [--exact-max-days N] [--report FILE] [--telemetry FILE] [--format text|json|binary] [--ingest pipelined|sequential] [--construction early|after-read] [--ingest-threads N|auto] [--parser fast|csv] [--input FILE | < input]" << std::endl;
+    std::cerr << "       " << program << " --batch [--jobs N|auto] [--output-dir DIR] [options above] FILE|DIR..." << std::endl;
+    std::cerr << "       " << program << " --serve SOCKET [--jobs N|auto] [options above]" << std::endl;
+    std::cerr << "       " << program << " --compile GRAPH [--ingest pipelined|sequential] [--ingest-threads N|auto] [--parser fast|csv] [--input FILE | < input]" << std::endl;
+    return 1;
+}
+
+
+int main(int argc, char **argv) {
+    run_options_t options;
+    const char *input_file = NULL;
+    const char *report_file = NULL;
+    const char *telemetry_file = NULL;
+    bool batch = false;
+    unsigned int jobs = 0;  // Of --batch and --serve, 0 fills the cores with search threads
+    const char *output_dir = NULL;
+    const char *socket_path = NULL;
+    const char *compile_file = NULL;
+    std::vector<std::string> inputs;
+
+    if (getenv("KIWI_TIME_LIMIT_MS") != NULL && (options.time_limit = parse_time_limit(getenv("KIWI_TIME_LIMIT_MS"))) == 0) {
+        std::cerr << "KIWI_TIME_LIMIT_MS must be a positive number of milliseconds" << std::endl;
+        return usage(argv[0]);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc) {
+            options.threads = parse_threads(argv[++i]);
+        } else if (strcmp(argv[i], "--eval-threads") == 0 && i + 1 < argc) {
+            options.eval_threads = parse_threads(argv[++i]);
+        } else if (strcmp(argv[i], "--moves") == 0 && i + 1 < argc && (options.search.moves = parse_moves(argv[i + 1])) != 0) {
+            ++i;
+        } else if (strcmp(argv[i], "--segment-period") == 0 && i + 1 < argc) {
+            options.search.segment_period = std::max(atoi(argv[++i]), 0);
+        } else if (strcmp(argv[i], "--candidates") == 0 && i + 1 < argc) {
+            options.search.candidates = std::min(std::max(atoi(argv[++i]), 0), (int) UINT16_MAX);
+        } else if (strcmp(argv[i], "--stagnation") == 0 && i + 1 < argc) {
+            options.search.stagnation = std::max(atoi(argv[++i]), 0);
+        } else if (strcmp(argv[i], "--elite") == 0 && i + 1 < argc) {
+            options.search.elite_size = std::max(atoi(argv[++i]), 0);
+        } else if (strcmp(argv[i], "--time-limit") == 0 && i + 1 < argc &&
+                   (options.time_limit = parse_time_limit(argv[i + 1])) != 0) {
+            ++i;
+        } else if ((strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--input") == 0) && i + 1 < argc) {
+            input_file = argv[++i];
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetry_file = argv[++i];
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            report_file = argv[++i];
+        } else if (strcmp(argv[i], "--exact-max-days") == 0 && i + 1 < argc) {
+            options.exact_max_days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dense-prices-mb") == 0 && i + 1 < argc) {
+            options.dense_prices_limit = (size_t) atol(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strcmp(argv[i + 1], "auto") == 0 ? 0 : parse_threads(argv[i + 1]);
+            ++i;
+        } else if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc) {
+            output_dir = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc && parse_format(argv[i + 1], options.format)) {
+            ++i;
+        } else if (strcmp(argv[i], "--ingest") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i + 1], "pipelined") == 0 || strcmp(argv[i + 1], "sequential") == 0)) {
+            options.pipelined_ingest = strcmp(argv[++i], "pipelined") == 0;
+        } else if (strcmp(argv[i], "--construction") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i + 1], "early") == 0 || strcmp(argv[i + 1], "after-read") == 0)) {
+            options.early_construction = strcmp(argv[++i], "early") == 0;
+        } else if (strcmp(argv[i], "--parser") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i + 1], "fast") == 0 || strcmp(argv[i + 1], "csv") == 0)) {
+            options.fast_parser = strcmp(argv[++i], "fast") == 0;
+        } else if (strcmp(argv[i], "--ingest-threads") == 0 && i + 1 < argc) {
+            options.ingest_threads = parse_threads(argv[++i]);
+        } else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+            compile_file = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (jobs == 0) jobs = std::max(parse_threads("auto") / options.threads, 1u);
+    options.collect_stats = report_file != NULL || telemetry_file != NULL;
+    // Instances of a batch or a server are read at the same time
+    if (options.ingest_threads == 0) {
+        options.ingest_threads = batch || socket_path != NULL ? std::max(parse_threads("auto") / jobs, 1u)
+                                                               : parse_threads("auto");
+    }
+
+    if (compile_file != NULL) {
+        if (batch || socket_path != NULL || !inputs.empty()) return usage(argv[0]);
+
+        // Nothing is solved, the DFS would only take a core from the reading
+        options.early_construction = false;
+
+        solver_buffers_t buffers;
+        solver_threads_t threads(options.threads, options.eval_threads, options.ingest_threads);
+        instance_t instance;
+        if (!load_instance(input_file, options, buffers, threads, instance)) return 1;
+        if (!write_graph(compile_file, buffers.nodes, instance.start, instance.days_total, instance.minimal_price)) {
+            std::cerr << "Can't write " << compile_file << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (socket_path != NULL) {
+        if (batch || input_file != NULL || !inputs.empty()) return usage(argv[0]);
+        return serve(socket_path, jobs, options);
+    }
+
+    if (!batch) {
+        if (!inputs.empty()) return usage(argv[0]);
+
+        solver_buffers_t buffers;
+        solver_threads_t threads(options.threads, options.eval_threads, options.ingest_threads);
+        run_report_t report;
+        search_stats_t stats;
+        solve_status_t status = solve_file(input_file, options, buffers, threads, report, stats);
+        if (status == SOLVED) buffers.output.write_to(STDOUT_FILENO);
+
+        if (report_file != NULL && status != BAD_INPUT) {
+            std::ofstream report_out(report_file);
+            report.write(report_out);
+        }
+        if (telemetry_file != NULL && status == SOLVED) {
+            std::ofstream telemetry_out(telemetry_file);
+            stats.write(telemetry_out);
+        }
+
+        return status == SOLVED ? 0 : 1;
+    }
+
+    if (input_file != NULL) inputs.insert(inputs.begin(), input_file);
+
+    std::vector<std::string> files;
+    for (auto it = inputs.cbegin(); it != inputs.cend(); ++it) {
+        if (!list_inputs(*it, files)) {
+            std::cerr << "Can't read " << *it << std::endl;
+            return 1;
+        }
+    }
+    if (files.empty()) return usage(argv[0]);
+
+    return solve_batch(files, output_dir, jobs, options, report_file, telemetry_file) == 0 ? 0 : 1;
+}
+
+const size_t arena_t::BLOCK_SIZE;
+const int32_t price_table_t::MISSING;
+const price_t branch_and_bound_t::NO_ROUTE;
+const size_t output_buffer_t::MAX_LEG_BYTES;
+const size_t flight_scanner_t::WINDOW;
+const size_t flight_scanner_t::READ_BLOCK;
+const uint16_t airport_index_t::ABSENT;
+const size_t airport_index_t::LETTER_CODES;
+
+// Lays out the routes of all nodes in the arena, ordered by (source, day,
+// destination), so that routes of one node are next to each other. Works
+// through the buckets one source at a time and frees them on the way.
+void build_graph(arena_t &arena, std::vector<node_t*> &nodes, flight_buckets_t &buckets) {
+    uint16_t days_total = buckets.days_total;
+    size_t buckets_total = nodes.size() * days_total;
+
+    // Duplicates are dropped, so the arrays can end up longer than needed
+    uint32_t *day_offsets = arena.make_array<uint32_t>(buckets_total + 1);
+    uint16_t *route_dests = arena.make_array<uint16_t>(buckets.flight_count);
+    route_t *routes = arena.make_array<route_t>(buckets.flight_count);
+    route_t **cheapest_routes = arena.make_array<route_t*>(buckets.flight_count);
+
+    std::vector<uint32_t> dest_start(nodes.size() + 1);
+    std::vector<uint32_t> day_start(days_total + 1);
+    std::vector<flight_t> by_dest, sorted;
+    std::vector<uint64_t> by_price;
+
+    uint32_t route_count = 0;
+    for (size_t src_idx = 0; src_idx < nodes.size(); ++src_idx) {
+        std::vector<flight_t> &flights = buckets.by_src[src_idx];
+
+        // Radix sort by (day, destination), counting sorts are stable so
+        // the input order of the same flight is kept
+        std::fill(dest_start.begin(), dest_start.end(), 0);
+        for (auto it = flights.cbegin(); it != flights.cend(); ++it) {
+            dest_start[it->dest_idx + 1]++;
+        }
+        for (size_t dest_idx = 0; dest_idx < nodes.size(); ++dest_idx) {
+            dest_start[dest_idx + 1] += dest_start[dest_idx];
+        }
+        by_dest.resize(flights.size());
+        for (auto it = flights.cbegin(); it != flights.cend(); ++it) {
+            by_dest[dest_start[it->dest_idx]++] = *it;
+        }
+        std::vector<flight_t>().swap(flights);
+
+        std::fill(day_start.begin(), day_start.end(), 0);
+        for (auto it = by_dest.cbegin(); it != by_dest.cend(); ++it) {
+            day_start[it->day + 1]++;
+        }
+        for (uint16_t day = 0; day < days_total; ++day) {
+            day_start[day + 1] += day_start[day];
+        }
+        sorted.resize(by_dest.size());
+        for (auto it = by_dest.cbegin(); it != by_dest.cend(); ++it) {
+            sorted[day_start[it->day]++] = *it;
+        }
+
+        // day_start[day] is the end of the day now
+        auto first = sorted.cbegin();
+        for (uint16_t day = 0; day < days_total; ++day) {
+            size_t bucket = src_idx * days_total + day;
+            day_offsets[bucket] = route_count;
+
+            auto last = sorted.cbegin() + day_start[day];
+            for (auto it = first; it != last; ++it) {
+                if (it + 1 != last && (it + 1)->dest_idx == it->dest_idx) {
+                    continue;  // Later input line for the same flight wins
+                }
+                route_dests[route_count] = it->dest_idx;
+                new (&routes[route_count]) route_t(nodes[it->src_idx], nodes[it->dest_idx], it->price);
+                route_count++;
+            }
+
+            // Sorting (price, index) keys keeps equal prices in destination
+            // order without following the pointers
+            by_price.clear();
+            for (uint32_t k = day_offsets[bucket]; k < route_count; ++k) {
+                by_price.push_back((uint64_t) routes[k].price << 32 | k);
+            }
+            std::sort(by_price.begin(), by_price.end());
+            route_t **cheapest = cheapest_routes + day_offsets[bucket];
+            for (auto it = by_price.cbegin(); it != by_price.cend(); ++it) {
+                *cheapest++ = &routes[(uint32_t) *it];
+            }
+            first = last;
+        }
+    }
+    day_offsets[buckets_total] = route_count;
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+        (*it)->day_offsets = day_offsets + (size_t) (*it)->idx * days_total;
+        (*it)->route_dests = route_dests;
+        (*it)->routes = routes;
+        (*it)->cheapest_routes = cheapest_routes;
+    }
 }
 
 bool nodename_compare_t::operator () (const nodename_t &lhs, const nodename_t &rhs) const {
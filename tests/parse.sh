@@ -0,0 +1,130 @@
+#!/bin/sh
+# Checks that the input parsers agree. Every file in tests/parser is
+# compiled with --compile by the fast parser and by the CSV reader, and the
+# compiled graphs have to be byte-identical. Each of the bad lines below is
+# put into tests/parser/plain.txt after line 151, far enough in for the
+# vector path to see it, and the result has to be refused by both. The
+# CSV reader only takes single spaces between the columns and no blank
+# lines, the fast parser takes any run of spaces and tabs, so the CSV
+# reader gets the file with its whitespace normalized.
+#
+# A generated input large enough to be split is then read with one and with
+# several --ingest-threads, pipelined, and from stdin in blocks, with LF
+# and CRLF line ends, and with a bad line near its end.
+#
+# Usage: tests/parse.sh
+#
+# KIWI and GENERATE override the binaries used.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+KIWI=${KIWI:-./kiwi}
+GENERATE=${GENERATE:-bench/generate}
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+failed=0
+
+# compile NAME ARGS...: compiles into $scratch/NAME, the exit status of
+# kiwi goes to $scratch/NAME.status and its messages to $scratch/NAME.err
+compile() {
+    name=$1
+    shift
+    rm -f "$scratch/$name"
+    status=0
+    "$KIWI" --compile "$scratch/$name" "$@" > /dev/null 2> "$scratch/$name.err" || status=$?
+    echo $status > "$scratch/$name.status"
+}
+
+succeeded() {
+    [ "$(cat "$scratch/$1.status")" = 0 ] && [ -s "$scratch/$1" ]
+}
+
+# same WHAT A B: both compiled to the same graph
+same() {
+    if succeeded "$2" && succeeded "$3" && cmp -s "$scratch/$2" "$scratch/$3"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: $(cat "$scratch/$2.err" "$scratch/$3.err" | head -n 2)"
+        failed=1
+    fi
+}
+
+# refused WHAT A B: both failed
+refused() {
+    if ! succeeded "$2" && ! succeeded "$3"; then
+        echo "ok   $1 refused"
+    else
+        echo "FAIL $1 was accepted"
+        failed=1
+    fi
+}
+
+# compare_parsers INPUT: the fast parser on INPUT, the CSV reader on it
+# with its whitespace normalized
+compare_parsers() {
+    tr '\t' ' ' < "$1" | tr -s ' ' | sed 's/^ //; s/ $//; s/ \r$/\r/' | grep -v '^\r*$' > "$scratch/normalized.txt" || true
+
+    compile fast --parser fast --input "$1"
+    compile csv --parser csv --input "$scratch/normalized.txt"
+}
+
+# Input that can't be mapped has to be read by the same parser
+for input in tests/parser/*.txt; do
+    compare_parsers "$input"
+    same "$input" fast csv
+    cat "$input" | compile piped --parser fast --input /dev/stdin
+    same "$input through a pipe" fast piped
+done
+
+while read -r bad; do
+    { head -n 151 tests/parser/plain.txt; echo "$bad"; tail -n +152 tests/parser/plain.txt; } > "$scratch/bad.txt"
+    compare_parsers "$scratch/bad.txt"
+    refused "\"$bad\"" fast csv
+done <<EOF
+AAA BBB 3
+AAA BBB 65535 10
+AAA BBB 00065535 10
+AAAA BBB 3 10
+AAA BBB -3 10
+AAA BBB 3 1x
+AAA BBB 3 123456789
+AAA BBB 3 65536
+AAA BBB 3 00065536
+AAA BBB 3 4294967306
+EOF
+
+# About 2.5 MB, more than one piece per thread for two threads
+"$GENERATE" --airports 250 --density 0.01 --seed 5 > "$scratch/large.txt"
+sed 's/$/\r/' "$scratch/large.txt" > "$scratch/large-crlf.txt"
+head -c -1 "$scratch/large.txt" > "$scratch/large-no-final-newline.txt"
+sed '$s/ [0-9]*$/ 65536/' "$scratch/large.txt" > "$scratch/large-bad.txt"
+
+for large in large large-crlf large-no-final-newline; do
+    input="$scratch/$large.txt"
+    compile csv --parser csv --ingest sequential --input "$input"
+    compile sequential --ingest sequential --ingest-threads 1 --input "$input"
+    compile pipelined --ingest pipelined --ingest-threads 1 --input "$input"
+    compile pieces --ingest-threads 4 --input "$input"
+    compile stdin --ingest-threads 4 < "$input"
+    same "$large sequential" csv sequential
+    same "$large pipelined" csv pipelined
+    same "$large --ingest-threads 4" csv pieces
+    same "$large from stdin" csv stdin
+done
+
+# The error has to name the same line however the input was split
+compile sequential --ingest sequential --ingest-threads 1 --input "$scratch/large-bad.txt"
+compile pieces --ingest-threads 4 --input "$scratch/large-bad.txt"
+refused "large-bad" sequential pieces
+if cmp -s "$scratch/sequential.err" "$scratch/pieces.err"; then
+    echo "ok   large-bad same message"
+else
+    echo "FAIL large-bad messages differ: $(cat "$scratch/sequential.err" "$scratch/pieces.err")"
+    failed=1
+fi
+
+exit $failed
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Solves the instances listed in tests/expected and compares the price
+# kiwi prints with the optimum given there. All of them are small enough
+# to be proven optimal, so any difference is a bug. Each instance is also
+# compiled with --compile and solved again from the compiled graph, and
+# read from stdin with the construction starting while it's read.
+#
+# Usage: tests/run.sh
+#
+# KIWI overrides the binary under test.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+KIWI=${KIWI:-./kiwi}
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+failed=0
+while read -r instance price; do
+    case "$instance" in
+        ''|'#'*) continue ;;
+    esac
+
+    got=$("$KIWI" --time-limit 5000 --input "$instance" 2> /dev/null | head -n 1) || true
+    if [ "$got" = "$price" ]; then
+        echo "ok   $instance $price"
+    else
+        echo "FAIL $instance expected $price, got ${got:-nothing}"
+        failed=1
+    fi
+
+    got=$("$KIWI" --time-limit 5000 --ingest pipelined --construction early < "$instance" 2> /dev/null | head -n 1) || true
+    if [ "$got" = "$price" ]; then
+        echo "ok   $instance $price early construction"
+    else
+        echo "FAIL $instance early construction expected $price, got ${got:-nothing}"
+        failed=1
+    fi
+
+    graph="$scratch/graph"
+    got=$("$KIWI" --compile "$graph" --input "$instance" 2> /dev/null &&
+          "$KIWI" --time-limit 5000 --input "$graph" 2> /dev/null | head -n 1) || true
+    if [ "$got" = "$price" ]; then
+        echo "ok   $instance $price compiled"
+    else
+        echo "FAIL $instance compiled expected $price, got ${got:-nothing}"
+        failed=1
+    fi
+done < tests/expected
+
+# A compiled graph whose first airport name lost its terminator (names
+# start right after the 32 byte header) has to be refused, not printed
+"$KIWI" --compile "$scratch/graph" --input test.txt 2> /dev/null
+printf 'AAAA' | dd of="$scratch/graph" bs=1 seek=32 conv=notrunc 2> /dev/null
+if "$KIWI" --time-limit 5000 --input "$scratch/graph" > /dev/null 2>&1; then
+    echo "FAIL damaged airport name was accepted"
+    failed=1
+else
+    echo "ok   damaged airport name refused"
+fi
+
+exit $failed